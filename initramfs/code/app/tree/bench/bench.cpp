@@ -0,0 +1,553 @@
+// tree 的基准测试: 在临时目录下生成可复现的合成目录树, 按各种模式运行 tree,
+// 记录墙钟时间, 系统调用次数和峰值内存, 并与保存的基线比较.
+//
+// 用法: tree-bench [-n 次数] [-b 基线文件] [--save] [--keep] TREE
+//   -n       每个组合计时的次数, 取中位数 (默认 5, 之前另有一次预热)
+//   -b       基线文件 (默认 bench/baseline.tsv)
+//   --save   把本次结果写入基线文件
+//   --keep   保留生成的目录树
+// 有基线时逐项比较, 出现回退则以状态 1 退出.
+//
+// 系统调用次数优先用 perf_event_open 统计 raw_syscalls:sys_enter 跟踪点 (含子线程);
+// 没有权限或内核不支持时退回 /proc/<pid>/io 中的读写调用次数 (syscr + syscw), 并在表头注明.
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <ftw.h>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+[[noreturn]] void die(const std::string& what) {
+    std::cerr << "tree-bench: " << what << ": " << std::strerror(errno) << std::endl;
+    exit(2);
+}
+
+// 固定种子的 xorshift, 保证每次生成的目录树完全相同
+struct Rng {
+    uint64_t s;
+    explicit Rng(uint64_t seed) : s(seed) {}
+    uint64_t next() {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return s;
+    }
+    size_t below(size_t n) { return next() % n; }
+};
+
+std::string random_name(Rng& rng, size_t min_len, size_t max_len) {
+    static const char CHARS[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-.";
+    size_t len = min_len + rng.below(max_len - min_len + 1);
+    std::string name;
+    for (size_t i = 0; i < len; ++i) {
+        name += CHARS[rng.below(sizeof(CHARS) - 1)];
+    }
+    if (name[0] == '.') { // 不生成隐藏文件
+        name[0] = '_';
+    }
+    return name;
+}
+
+void make_dir(const std::string& path) {
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+        die("mkdir " + path);
+    }
+}
+
+void make_file(const std::string& path, size_t size, mode_t mode = 0644) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd < 0) {
+        die("create " + path);
+    }
+    static const std::string data(64 * 1024, 'x');
+    while (size > 0) {
+        size_t n = std::min(size, data.size());
+        if (write(fd, data.data(), n) != static_cast<ssize_t>(n)) {
+            die("write " + path);
+        }
+        size -= n;
+    }
+    close(fd);
+    chmod(path.c_str(), mode); // 不受 umask 影响
+}
+
+void make_link(const std::string& target, const std::string& path) {
+    if (symlink(target.c_str(), path.c_str()) != 0 && errno != EEXIST) {
+        die("symlink " + path);
+    }
+}
+
+// 场景 ---------------------------------------------------------------------
+
+// 一个目录下两万个文件
+void gen_wide(const std::string& root) {
+    Rng rng(1);
+    make_dir(root);
+    for (int i = 0; i < 20000; ++i) {
+        make_file(root + "/" + random_name(rng, 6, 20) + std::to_string(i), 0);
+    }
+}
+
+// 1500 层, 每层一个目录和一个文件
+void gen_deep(const std::string& root) {
+    make_dir(root);
+    int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    for (int i = 0; i < 1500 && fd >= 0; ++i) {
+        int f = openat(fd, "f", O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (f < 0 || mkdirat(fd, "d", 0755) != 0) {
+            die("deep level " + std::to_string(i));
+        }
+        close(f);
+        int next = openat(fd, "d", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = next;
+    }
+    if (fd < 0) {
+        die("open deep level");
+    }
+    close(fd);
+}
+
+// 三层目录, 大量指向文件, 目录, 上层目录 (环) 的链接和断链
+void gen_symlinks(const std::string& root) {
+    Rng rng(2);
+    make_dir(root);
+    std::vector<std::string> dirs, files;
+    for (int a = 0; a < 6; ++a) {
+        std::string da = root + "/d" + std::to_string(a);
+        make_dir(da);
+        dirs.push_back(da);
+        for (int b = 0; b < 6; ++b) {
+            std::string db = da + "/s" + std::to_string(b);
+            make_dir(db);
+            dirs.push_back(db);
+            for (int c = 0; c < 10; ++c) {
+                std::string f = db + "/f" + std::to_string(c);
+                make_file(f, 0);
+                files.push_back(f);
+            }
+        }
+    }
+    for (size_t i = 0; i < dirs.size(); ++i) {
+        const std::string& dir = dirs[i];
+        for (int k = 0; k < 25; ++k) {
+            std::string link = dir + "/l" + std::to_string(k);
+            switch (rng.below(10)) {
+            case 0: make_link("missing-" + std::to_string(k), link); break; // 断链
+            case 1: make_link("..", link); break;                          // 指向上层: -l 时是环
+            case 2:
+            case 3: {
+                // 指向某个第二层目录 (绝对路径)
+                const std::string& target = dirs[rng.below(dirs.size())];
+                make_link(target.find("/s") != std::string::npos ? target : target + "/s0", link);
+                break;
+            }
+            default: make_link(files[rng.below(files.size())], link); break;
+            }
+        }
+    }
+}
+
+// 各种文件类型和权限: 可执行, setuid, setgid, 粘滞目录, 管道, 硬链接, 不同大小
+void gen_mixed(const std::string& root) {
+    Rng rng(3);
+    make_dir(root);
+    for (int d = 0; d < 40; ++d) {
+        std::string dir = root + "/dir" + std::to_string(d);
+        make_dir(dir);
+        if (d % 7 == 0) {
+            chmod(dir.c_str(), 01777);
+        }
+        std::string first;
+        for (int i = 0; i < 120; ++i) {
+            std::string path = dir + "/" + random_name(rng, 3, 12);
+            switch (rng.below(12)) {
+            case 0: make_file(path + ".sh", 16, 0755); break;
+            case 1: make_file(path + ".bin", 4096, 04755); break;
+            case 2: make_file(path + ".g", 0, 02755); break;
+            case 3:
+                if (mkfifo((path + ".fifo").c_str(), 0644) != 0 && errno != EEXIST) {
+                    die("mkfifo " + path);
+                }
+                break;
+            case 4:
+                if (!first.empty() && link(first.c_str(), (path + ".hard").c_str()) != 0 && errno != EEXIST) {
+                    die("link " + path);
+                }
+                break;
+            case 5: make_file(path + ".dat", 1 + rng.below(256 * 1024)); break;
+            default:
+                make_file(path + ".txt", rng.below(2048));
+                if (first.empty()) {
+                    first = path + ".txt";
+                }
+                break;
+            }
+        }
+    }
+}
+
+// UTF-8 名字: 中日韩, emoji, 组合字符, 从右到左的文字, 以及需要在 JSON 中转义的字符;
+// 另有几段不是合法 UTF-8 的字节 (孤立的 0xff, 截断的序列, 超长编码), JSON 输出中应写成 \u00XX
+void gen_unicode(const std::string& root) {
+    static const char* PARTS[] = {"目录", "ファイル", "파일", "😀", "🌲", "e\xcc\x81", "Ωμέγα", "שלום",
+                                  "مرحبا", "naïve", "a b", "q\"t", "back\\slash", "tab\t", "Ä",
+                                  "bad\xff", "cut\xe6\x97", "\xc0\xafover"};
+    const size_t nparts = sizeof(PARTS) / sizeof(PARTS[0]);
+    Rng rng(4);
+    make_dir(root);
+    for (int d = 0; d < 30; ++d) {
+        std::string dir = root + "/" + PARTS[d % nparts] + std::to_string(d);
+        make_dir(dir);
+        for (int i = 0; i < 100; ++i) {
+            std::string name;
+            for (size_t k = 1 + rng.below(3); k > 0; --k) {
+                name += PARTS[rng.below(nparts)];
+            }
+            make_file(dir + "/" + name + std::to_string(i), 0);
+        }
+    }
+}
+
+struct Scenario {
+    const char* name;
+    void (*gen)(const std::string&);
+    const char* level; // -L 的参数
+};
+
+const Scenario SCENARIOS[] = {
+    {"wide", gen_wide, "2"},         {"deep", gen_deep, "2000"},   {"symlinks", gen_symlinks, "4"},
+    {"mixed", gen_mixed, "4"},       {"unicode", gen_unicode, "4"},
+};
+
+struct Mode {
+    const char* name;
+    std::vector<const char*> args;
+};
+
+const Mode MODES[] = {
+    {"text", {}},          {"color", {"-C"}},     {"json", {"-J"}},   {"ndjson", {"--ndjson"}},
+    {"du", {"--du"}},      {"parallel", {"-j", "4"}}, {"follow", {"-l"}},
+};
+
+// 测量 -------------------------------------------------------------------
+
+struct Sample {
+    double wall_ms = 0, user_ms = 0, sys_ms = 0;
+    long syscalls = -1;
+    long rss_kb = 0;
+};
+
+// raw_syscalls:sys_enter 的跟踪点编号, 没有 tracefs 时为 -1
+long syscall_tracepoint() {
+    static long id = -2;
+    if (id == -2) {
+        id = -1;
+        for (const char* dir : {"/sys/kernel/tracing", "/sys/kernel/debug/tracing"}) {
+            std::ifstream in(std::string(dir) + "/events/raw_syscalls/sys_enter/id");
+            if (in >> id) {
+                break;
+            }
+            id = -1;
+        }
+    }
+    return id;
+}
+
+// 统计 pid 的系统调用 (含之后创建的线程), 从 exec 开始计数; 失败返回 -1
+int open_syscall_counter(pid_t pid) {
+    long id = syscall_tracepoint();
+    if (id < 0) {
+        return -1;
+    }
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.config = id;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// /proc/<pid>/io 的 syscr + syscw; 进程已退出但尚未回收时仍可读取
+long proc_io_syscalls(pid_t pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/io");
+    std::string key;
+    long value, total = 0;
+    bool found = false;
+    while (in >> key >> value) {
+        if (key == "syscr:" || key == "syscw:") {
+            total += value;
+            found = true;
+        }
+    }
+    return found ? total : -1;
+}
+
+bool perf_used = false;
+
+double ms_between(const timespec& a, const timespec& b) {
+    return (b.tv_sec - a.tv_sec) * 1e3 + (b.tv_nsec - a.tv_nsec) / 1e6;
+}
+
+double tv_ms(const timeval& tv) { return tv.tv_sec * 1e3 + tv.tv_usec / 1e3; }
+
+// 运行一次, 输出丢到 /dev/null
+Sample run_once(const std::vector<std::string>& argv) {
+    int gate[2];
+    if (pipe2(gate, O_CLOEXEC) != 0) {
+        die("pipe");
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("fork");
+    }
+    if (pid == 0) {
+        char c;
+        close(gate[1]);
+        if (read(gate[0], &c, 1) != 1) { // 等父进程挂好计数器
+            _exit(127);
+        }
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        std::vector<char*> args;
+        for (const auto& a : argv) {
+            args.push_back(const_cast<char*>(a.c_str()));
+        }
+        args.push_back(nullptr);
+        execv(args[0], args.data());
+        _exit(127);
+    }
+    close(gate[0]);
+    int counter = open_syscall_counter(pid);
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (write(gate[1], "x", 1) != 1) {
+        die("release child");
+    }
+    close(gate[1]);
+
+    siginfo_t info;
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) != 0) {
+        if (errno != EINTR) {
+            die("waitid");
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    Sample s;
+    s.wall_ms = ms_between(start, end);
+    if (counter >= 0) {
+        uint64_t n;
+        if (read(counter, &n, sizeof(n)) == sizeof(n)) {
+            s.syscalls = n;
+            perf_used = true;
+        }
+        close(counter);
+    }
+    if (s.syscalls < 0) {
+        s.syscalls = proc_io_syscalls(pid);
+    }
+    int status;
+    rusage ru;
+    if (wait4(pid, &status, 0, &ru) != pid) {
+        die("wait4");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        errno = 0;
+        die("'" + argv[0] + "' did not run");
+    }
+    s.user_ms = tv_ms(ru.ru_utime);
+    s.sys_ms = tv_ms(ru.ru_stime);
+    s.rss_kb = ru.ru_maxrss;
+    return s;
+}
+
+// 预热一次后运行 runs 次; 时间取中位数, 内存和系统调用取最大值
+Sample measure(const std::vector<std::string>& argv, int runs) {
+    run_once(argv);
+    std::vector<Sample> samples;
+    for (int i = 0; i < runs; ++i) {
+        samples.push_back(run_once(argv));
+    }
+    auto median = [&](double Sample::*field) {
+        std::vector<double> v;
+        for (const auto& s : samples) {
+            v.push_back(s.*field);
+        }
+        std::sort(v.begin(), v.end());
+        return v[v.size() / 2];
+    };
+    Sample r;
+    r.wall_ms = median(&Sample::wall_ms);
+    r.user_ms = median(&Sample::user_ms);
+    r.sys_ms = median(&Sample::sys_ms);
+    for (const auto& s : samples) {
+        r.syscalls = std::max(r.syscalls, s.syscalls);
+        r.rss_kb = std::max(r.rss_kb, s.rss_kb);
+    }
+    return r;
+}
+
+// 基线 -------------------------------------------------------------------
+// 每行: 场景 <TAB> 模式 <TAB> 墙钟毫秒 <TAB> 系统调用 <TAB> 峰值内存 KB
+
+using Baseline = std::map<std::string, Sample>;
+
+Baseline load_baseline(const std::string& file) {
+    Baseline base;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream ss(line);
+        std::string scenario, mode;
+        Sample s;
+        if (std::getline(ss, scenario, '\t') && std::getline(ss, mode, '\t') && ss >> s.wall_ms >> s.syscalls >> s.rss_kb) {
+            base[scenario + "/" + mode] = s;
+        }
+    }
+    return base;
+}
+
+// 墙钟和内存超过基线 10% (且墙钟多出 2 ms 以上, 避开计时噪声), 或系统调用变多, 算作回退
+std::string regressions(const Sample& now, const Sample& base) {
+    std::string r;
+    if (now.wall_ms > base.wall_ms * 1.10 && now.wall_ms - base.wall_ms > 2) {
+        r += " time";
+    }
+    if (base.syscalls >= 0 && now.syscalls > base.syscalls) {
+        r += " syscalls";
+    }
+    if (now.rss_kb > base.rss_kb * 1.10) {
+        r += " rss";
+    }
+    return r;
+}
+
+std::string percent(double now, double base) {
+    if (base <= 0) {
+        return "";
+    }
+    std::ostringstream ss;
+    ss << std::showpos << std::fixed << std::setprecision(0) << (now - base) * 100 / base << "%";
+    return ss.str();
+}
+
+int remove_entry(const char* path, const struct stat*, int, struct FTW*) { return remove(path); }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int runs = 5;
+    std::string baseline_file = "bench/baseline.tsv";
+    bool save = false, keep = false;
+    std::string tree;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            runs = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-b" && i + 1 < argc) {
+            baseline_file = argv[++i];
+        } else if (arg == "--save") {
+            save = true;
+        } else if (arg == "--keep") {
+            keep = true;
+        } else {
+            tree = arg;
+        }
+    }
+    if (tree.empty()) {
+        std::cerr << "usage: tree-bench [-n runs] [-b baseline.tsv] [--save] [--keep] TREE" << std::endl;
+        return 2;
+    }
+    if (tree.find('/') == std::string::npos) {
+        tree = "./" + tree;
+    }
+
+    const char* tmp = getenv("TMPDIR");
+    std::string work = std::string(tmp && *tmp ? tmp : "/tmp") + "/tree-bench-XXXXXX";
+    if (!mkdtemp(&work[0])) {
+        die("mkdtemp");
+    }
+    for (const auto& sc : SCENARIOS) {
+        sc.gen(work + "/" + sc.name);
+    }
+
+    Baseline base = load_baseline(baseline_file);
+    std::ostringstream saved;
+    saved << "# scenario\tmode\twall_ms\tsyscalls\trss_kb\n";
+    bool regressed = false;
+    bool header = false;
+    for (const auto& sc : SCENARIOS) {
+        for (const auto& mode : MODES) {
+            std::vector<std::string> args = {tree, "-L", sc.level};
+            args.insert(args.end(), mode.args.begin(), mode.args.end());
+            args.push_back(work + "/" + sc.name);
+            Sample s = measure(args, runs);
+            if (!header) {
+                std::cout << std::left << std::setw(10) << "scenario" << std::setw(10) << "mode" << std::right
+                          << std::setw(10) << "wall ms" << std::setw(10) << "user ms" << std::setw(10) << "sys ms"
+                          << std::setw(12) << (perf_used ? "syscalls" : "rw calls") << std::setw(10) << "rss KB"
+                          << "  vs baseline" << std::endl;
+                header = true;
+            }
+            std::cout << std::left << std::setw(10) << sc.name << std::setw(10) << mode.name << std::right
+                      << std::fixed << std::setprecision(1) << std::setw(10) << s.wall_ms << std::setw(10)
+                      << s.user_ms << std::setw(10) << s.sys_ms << std::setw(12) << s.syscalls << std::setw(10)
+                      << s.rss_kb;
+            auto it = base.find(std::string(sc.name) + "/" + mode.name);
+            if (it != base.end()) {
+                std::string bad = regressions(s, it->second);
+                std::cout << "  time " << percent(s.wall_ms, it->second.wall_ms) << ", rss "
+                          << percent(s.rss_kb, it->second.rss_kb);
+                if (!bad.empty()) {
+                    std::cout << "  REGRESSION:" << bad;
+                    regressed = true;
+                }
+            }
+            std::cout << std::endl;
+            saved << sc.name << '\t' << mode.name << '\t' << std::fixed << std::setprecision(2) << s.wall_ms << '\t'
+                  << s.syscalls << '\t' << s.rss_kb << '\n';
+        }
+    }
+
+    if (keep) {
+        std::cout << "trees kept in " << work << std::endl;
+    } else {
+        nftw(work.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+    }
+    if (save) {
+        std::ofstream outf(baseline_file);
+        if (!(outf << saved.str())) {
+            die("write " + baseline_file);
+        }
+        std::cout << "baseline saved to " << baseline_file << std::endl;
+    } else if (base.empty()) {
+        std::cout << "no baseline at " << baseline_file << " (run with --save to create one)" << std::endl;
+    }
+    return regressed ? 1 : 0;
+}
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <dirent.h>
+#include <map>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <utility>
+#include <vector>
+
+// -C 的配色, 格式与 GNU ls 的 LS_COLORS 相同: "键=SGR参数" 以 ':' 分隔, 键为两个字母的类型
+// (di ln ex su sg st ow tw mh pi so bd cd do or mi fi no, 以及 lc rc ec rs) 或 "*后缀".
+// 启动时编译一次: 每个不同的颜色串只存一份, 目录项中只记一个字节的编号 (0 为不上色).
+// "*.ext" 形式的扩展名 (不区分大小写) 放进一张无冲突哈希表: 先按一级哈希分桶, 每个桶找一个种子,
+// 使桶内各键的二级哈希都落在空槽中 (CHD). 查找时算一次哈希, 比较一次字符串.
+// 其它后缀 (*~ *.tar.gz 之类) 数量很少, 逐个比较.
+// 没有 LS_COLORS 时使用与原来相同的四种颜色. 未设置的特殊类型 (管道, 设备等) 按 fi 上色.
+class LsColors {
+  public:
+    static constexpr uint8_t NONE = 0;
+
+    LsColors() { load(nullptr); }
+
+    void load(const char* spec) {
+        *this = LsColors(0);
+        parse(spec && *spec ? spec : "di=1;34:fi=0:ex=1;32:ln=1;36");
+        compile();
+    }
+
+    const std::string& code(uint8_t idx) const { return codes_[idx]; }
+    const std::string& reset() const { return reset_; }
+
+    // 给这种 d_type 的目录项上色是否需要它的 lstat (mode, nlink)
+    bool needs_stat(unsigned char type) const {
+        switch (type) {
+        case DT_UNKNOWN: return true;
+        case DT_REG: return file_needs_stat_;
+        case DT_DIR: return dir_needs_stat_;
+        default: return false;
+        }
+    }
+
+    // name 为目录项名字, type 为 d_type; have_stat 时 mode, nlink 来自 lstat.
+    // 符号链接: link_ok 表示目标存在, target_mode 为跟随后的 mode
+    uint8_t color(std::string_view name, unsigned char type, bool have_stat, uint32_t mode, uint64_t nlink,
+                  bool link_ok, uint32_t target_mode) const {
+        if (have_stat) {
+            type = IFTODT(mode);
+        }
+        switch (type) {
+        case DT_LNK:
+            if (!link_ok) {
+                return idx_[ORPHAN] ? idx_[ORPHAN] : idx_[LINK];
+            }
+            if (link_target_ && target_mode) {
+                return color(name, IFTODT(target_mode), true, target_mode, 1, true, 0);
+            }
+            return idx_[LINK];
+        case DT_DIR:
+            if (have_stat) {
+                bool sticky = mode & S_ISVTX, writable = mode & S_IWOTH;
+                if (sticky && writable && idx_[STICKY_OTHER_WRITABLE]) {
+                    return idx_[STICKY_OTHER_WRITABLE];
+                }
+                if (writable && idx_[OTHER_WRITABLE]) {
+                    return idx_[OTHER_WRITABLE];
+                }
+                if (sticky && idx_[STICKY]) {
+                    return idx_[STICKY];
+                }
+            }
+            return idx_[DIR];
+        case DT_FIFO: return special(FIFO);
+        case DT_SOCK: return special(SOCK);
+        case DT_BLK: return special(BLK);
+        case DT_CHR: return special(CHR);
+        default: break;
+        }
+        if (have_stat) {
+            if ((mode & S_ISUID) && idx_[SETUID]) {
+                return idx_[SETUID];
+            }
+            if ((mode & S_ISGID) && idx_[SETGID]) {
+                return idx_[SETGID];
+            }
+            if ((mode & (S_IXUSR | S_IXGRP | S_IXOTH)) && idx_[EXEC]) {
+                return idx_[EXEC];
+            }
+            if (nlink > 1 && idx_[MULTI_HARDLINK]) {
+                return idx_[MULTI_HARDLINK];
+            }
+        }
+        uint8_t c = suffix_color(name);
+        return c ? c : idx_[FILE];
+    }
+
+  private:
+    enum Kind {
+        NORMAL, FILE, DIR, LINK, FIFO, SOCK, BLK, CHR, DOOR, ORPHAN, MISSING, EXEC, SETUID, SETGID, STICKY,
+        OTHER_WRITABLE, STICKY_OTHER_WRITABLE, MULTI_HARDLINK, CAPABILITY, LEFT, RIGHT, END, RESET, KIND_COUNT
+    };
+    static constexpr const char* KEYS[KIND_COUNT] = {"no", "fi", "di", "ln", "pi", "so", "bd", "cd",
+                                                     "do", "or", "mi", "ex", "su", "sg", "st", "ow",
+                                                     "tw", "mh", "ca", "lc", "rc", "ec", "rs"};
+
+    std::string raw_[KIND_COUNT];
+    bool set_[KIND_COUNT] = {};
+    uint8_t idx_[KIND_COUNT] = {};
+    bool link_target_ = false; // ln=target: 链接按目标上色
+    bool file_needs_stat_ = false, dir_needs_stat_ = false;
+    std::vector<std::string> codes_{""};
+    std::string reset_;
+    std::vector<std::pair<std::string, std::string>> suffix_specs_; // 解析时按出现顺序记录
+
+    // 其它后缀, 后出现的优先
+    std::vector<std::pair<std::string, uint8_t>> suffixes_;
+    // 扩展名的无冲突哈希表
+    std::vector<std::string> ext_keys_;
+    std::vector<uint8_t> ext_colors_;
+    std::vector<uint32_t> seeds_;  // 每个一级桶的种子
+    std::vector<int32_t> slots_;   // 二级槽 -> ext_keys_ 下标, -1 为空
+    uint64_t slot_mask_ = 0;
+
+    explicit LsColors(int) {}
+
+    uint8_t special(Kind k) const { return idx_[k] ? idx_[k] : idx_[FILE]; }
+
+    static char lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+    static uint64_t hash(std::string_view s) {
+        uint64_t h = 1469598103934665603ULL;
+        for (char c : s) {
+            h = (h ^ static_cast<unsigned char>(lower(c))) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static uint64_t mix(uint64_t h, uint32_t seed) {
+        h += seed * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
+    }
+
+    static bool equal_nocase(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (lower(a[i]) != lower(b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 值中的转义: \a \b \e \f \n \r \t \v \\ \NNN (八进制) \xHH 以及 ^X
+    static std::string unescape(std::string_view v) {
+        std::string r;
+        for (size_t i = 0; i < v.size(); ++i) {
+            char c = v[i];
+            if (c == '^' && i + 1 < v.size()) {
+                char n = v[++i];
+                r += n == '?' ? '\177' : static_cast<char>(n & 0x1f);
+            } else if (c == '\\' && i + 1 < v.size()) {
+                char n = v[++i];
+                switch (n) {
+                case 'a': r += '\a'; break;
+                case 'b': r += '\b'; break;
+                case 'e': r += '\033'; break;
+                case 'f': r += '\f'; break;
+                case 'n': r += '\n'; break;
+                case 'r': r += '\r'; break;
+                case 't': r += '\t'; break;
+                case 'v': r += '\v'; break;
+                case '_': r += ' '; break;
+                case 'x': {
+                    int val = 0, k = 0;
+                    for (; k < 2 && i + 1 < v.size() && isxdigit(static_cast<unsigned char>(v[i + 1])); ++k) {
+                        char h = lower(v[++i]);
+                        val = val * 16 + (h <= '9' ? h - '0' : h - 'a' + 10);
+                    }
+                    r += static_cast<char>(val);
+                    break;
+                }
+                default:
+                    if (n >= '0' && n <= '7') {
+                        int val = n - '0';
+                        for (int k = 0; k < 2 && i + 1 < v.size() && v[i + 1] >= '0' && v[i + 1] <= '7'; ++k) {
+                            val = val * 8 + (v[++i] - '0');
+                        }
+                        r += static_cast<char>(val);
+                    } else {
+                        r += n;
+                    }
+                }
+            } else {
+                r += c;
+            }
+        }
+        return r;
+    }
+
+    void parse(std::string_view spec) {
+        while (!spec.empty()) {
+            size_t end = spec.find(':');
+            std::string_view item = spec.substr(0, end);
+            spec.remove_prefix(end == std::string_view::npos ? spec.size() : end + 1);
+            size_t eq = item.find('=');
+            if (eq == std::string_view::npos) {
+                continue;
+            }
+            std::string_view key = item.substr(0, eq), value = item.substr(eq + 1);
+            if (!key.empty() && key[0] == '*') {
+                suffix_specs_.emplace_back(unescape(key.substr(1)), unescape(value));
+                continue;
+            }
+            for (int k = 0; k < KIND_COUNT; ++k) {
+                if (key == KEYS[k]) {
+                    raw_[k] = unescape(value);
+                    set_[k] = true;
+                }
+            }
+        }
+    }
+
+    // 颜色串只存一份; 超过 255 种时多出的不上色
+    uint8_t intern(const std::string& value) {
+        if (value.empty()) {
+            return NONE;
+        }
+        std::string seq = (set_[LEFT] ? raw_[LEFT] : "\033[") + value + (set_[RIGHT] ? raw_[RIGHT] : "m");
+        for (size_t i = 1; i < codes_.size(); ++i) {
+            if (codes_[i] == seq) {
+                return i;
+            }
+        }
+        if (codes_.size() > 255) {
+            return NONE;
+        }
+        codes_.push_back(seq);
+        return codes_.size() - 1;
+    }
+
+    void compile() {
+        link_target_ = raw_[LINK] == "target";
+        for (int k = NORMAL; k < LEFT; ++k) {
+            // 与 ls 一样, "0" 和 "00" 视为未设置; fi 例外, 原来的默认配色就是 fi=0
+            bool off = k != FILE && (raw_[k] == "0" || raw_[k] == "00");
+            if (!off && !(k == LINK && link_target_)) {
+                idx_[k] = intern(raw_[k]);
+            }
+        }
+        if (link_target_) {
+            idx_[LINK] = idx_[FILE];
+        }
+        reset_ = set_[END] ? raw_[END]
+                           : (set_[LEFT] ? raw_[LEFT] : "\033[") + (set_[RESET] ? raw_[RESET] : "0") +
+                                 (set_[RIGHT] ? raw_[RIGHT] : "m");
+        file_needs_stat_ = idx_[EXEC] || idx_[SETUID] || idx_[SETGID] || idx_[MULTI_HARDLINK];
+        dir_needs_stat_ = idx_[STICKY] || idx_[OTHER_WRITABLE] || idx_[STICKY_OTHER_WRITABLE];
+
+        // "*.ext" 进哈希表 (同一扩展名以最后一次为准), 其余后缀逐个比较
+        std::map<std::string, uint8_t> exts;
+        for (const auto& [suffix, value] : suffix_specs_) {
+            uint8_t c = intern(value);
+            bool plain_ext = suffix.size() > 1 && suffix[0] == '.' && suffix.find('.', 1) == std::string::npos;
+            if (plain_ext) {
+                std::string key;
+                for (char ch : suffix.substr(1)) {
+                    key += lower(ch);
+                }
+                exts[key] = c;
+            } else {
+                suffixes_.insert(suffixes_.begin(), {suffix, c});
+            }
+        }
+        suffix_specs_.clear();
+        build_hash(exts);
+    }
+
+    void build_hash(const std::map<std::string, uint8_t>& exts) {
+        size_t n = exts.size();
+        if (n == 0) {
+            return;
+        }
+        for (const auto& [key, c] : exts) {
+            ext_keys_.push_back(key);
+            ext_colors_.push_back(c);
+        }
+        size_t m = 1;
+        while (m < n + n / 4 + 1) {
+            m <<= 1;
+        }
+        slot_mask_ = m - 1;
+        slots_.assign(m, -1);
+        size_t nb = n / 4 + 1;
+        seeds_.assign(nb, 0);
+        std::vector<std::vector<int32_t>> buckets(nb);
+        for (size_t i = 0; i < n; ++i) {
+            buckets[hash(ext_keys_[i]) % nb].push_back(i);
+        }
+        std::vector<size_t> order(nb);
+        for (size_t b = 0; b < nb; ++b) {
+            order[b] = b;
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](size_t a, size_t b) { return buckets[a].size() > buckets[b].size(); });
+        std::vector<uint64_t> tried;
+        for (size_t b : order) {
+            const auto& keys = buckets[b];
+            if (keys.empty()) {
+                continue;
+            }
+            bool placed = false;
+            for (uint32_t seed = 1; seed < (1u << 16) && !placed; ++seed) {
+                tried.clear();
+                placed = true;
+                for (int32_t k : keys) {
+                    uint64_t s = mix(hash(ext_keys_[k]), seed) & slot_mask_;
+                    if (slots_[s] >= 0 || std::find(tried.begin(), tried.end(), s) != tried.end()) {
+                        placed = false;
+                        break;
+                    }
+                    tried.push_back(s);
+                }
+                if (placed) {
+                    seeds_[b] = seed;
+                    for (size_t j = 0; j < keys.size(); ++j) {
+                        slots_[tried[j]] = keys[j];
+                    }
+                }
+            }
+            if (!placed) { // 只有一级哈希完全相同的键才会放不下, 改为逐个比较
+                for (int32_t k : keys) {
+                    suffixes_.push_back({"." + ext_keys_[k], ext_colors_[k]});
+                }
+            }
+        }
+    }
+
+    uint8_t suffix_color(std::string_view name) const {
+        for (const auto& [suffix, c] : suffixes_) {
+            if (name.size() >= suffix.size() && equal_nocase(name.substr(name.size() - suffix.size()), suffix)) {
+                return c;
+            }
+        }
+        if (slots_.empty()) {
+            return NONE;
+        }
+        size_t dot = name.rfind('.');
+        if (dot == std::string_view::npos || dot + 1 == name.size()) {
+            return NONE;
+        }
+        std::string_view ext = name.substr(dot + 1);
+        uint64_t h = hash(ext);
+        int32_t k = slots_[mix(h, seeds_[h % seeds_.size()]) & slot_mask_];
+        return k >= 0 && equal_nocase(ext_keys_[k], ext) ? ext_colors_[k] : NONE;
+    }
+};
+
+inline LsColors ls_colors;
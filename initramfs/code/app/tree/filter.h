@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cerrno>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+// 文件名过滤: -P / -I 的通配模式和 .gitignore 规则.
+// 模式只编译一次: 不含通配符的整串、"前缀*"、"*后缀" 和 "*" 直接比较, 其余编译成记号序列,
+// 匹配时按 NFA 的方式同时推进所有可能的位置 (O(记号数 × 长度), 不回溯).
+class Glob {
+  public:
+    // pathname 为 true 时 '*' '?' 和字符类不匹配 '/', "**" 可以跨目录 (.gitignore 中带 '/' 的模式)
+    explicit Glob(std::string_view pat, bool pathname = false) : pathname_(pathname) {
+        bool meta = pat.find_first_of("*?[\\") != std::string_view::npos;
+        if (!meta) {
+            kind_ = LITERAL;
+            lit_ = pat;
+        } else if (pat == "*" && !pathname) {
+            kind_ = ANY;
+        } else if (!pathname && pat.back() == '*' && pat.find_first_of("*?[\\") == pat.size() - 1) {
+            kind_ = PREFIX;
+            lit_ = pat.substr(0, pat.size() - 1);
+        } else if (!pathname && pat.front() == '*' && pat.find_first_of("*?[\\", 1) == std::string_view::npos) {
+            kind_ = SUFFIX;
+            lit_ = pat.substr(1);
+        } else {
+            kind_ = GENERAL;
+            compile(pat);
+        }
+    }
+
+    bool match(std::string_view s) const {
+        switch (kind_) {
+        case LITERAL: return s == lit_;
+        case ANY: return true;
+        case PREFIX: return s.size() >= lit_.size() && s.compare(0, lit_.size(), lit_) == 0;
+        case SUFFIX: return s.size() >= lit_.size() && s.compare(s.size() - lit_.size(), lit_.size(), lit_) == 0;
+        default: return match_general(s);
+        }
+    }
+
+  private:
+    enum Kind { LITERAL, ANY, PREFIX, SUFFIX, GENERAL };
+    enum TokType { CHAR, ONE, STAR, DSTAR, DSTAR_SLASH, CLASS };
+    struct Tok {
+        TokType type;
+        unsigned char c;  // CHAR
+        unsigned cls;     // CLASS: classes_ 的下标
+    };
+
+    Kind kind_;
+    bool pathname_;
+    std::string lit_;
+    std::vector<Tok> toks_;
+    std::vector<std::bitset<256>> classes_;
+
+    void compile(std::string_view p) {
+        for (size_t i = 0; i < p.size(); ++i) {
+            char c = p[i];
+            if (c == '*') {
+                bool dstar = pathname_ && i + 1 < p.size() && p[i + 1] == '*';
+                if (!dstar) {
+                    if (toks_.empty() || toks_.back().type != STAR) {
+                        toks_.push_back({STAR, 0, 0});
+                    }
+                    continue;
+                }
+                while (i + 1 < p.size() && p[i + 1] == '*') {
+                    ++i;
+                }
+                // "**/" 匹配零个或多个目录; 其它位置的 "**" 匹配任意串
+                if (i + 1 < p.size() && p[i + 1] == '/') {
+                    ++i;
+                    toks_.push_back({DSTAR_SLASH, 0, 0});
+                } else {
+                    toks_.push_back({DSTAR, 0, 0});
+                }
+            } else if (c == '?') {
+                toks_.push_back({ONE, 0, 0});
+            } else if (c == '[' && compile_class(p, i)) {
+                continue;
+            } else {
+                if (c == '\\' && i + 1 < p.size()) {
+                    c = p[++i];
+                }
+                toks_.push_back({CHAR, static_cast<unsigned char>(c), 0});
+            }
+        }
+    }
+
+    // [abc] [a-z] [!x] [^x]; 没有闭合的 ']' 时按普通字符处理. 成功时 i 指向 ']'
+    bool compile_class(std::string_view p, size_t& i) {
+        size_t j = i + 1;
+        bool negate = j < p.size() && (p[j] == '!' || p[j] == '^');
+        if (negate) {
+            ++j;
+        }
+        std::bitset<256> set;
+        bool first = true;
+        for (; j < p.size() && (p[j] != ']' || first); ++j, first = false) {
+            unsigned char lo = p[j];
+            if (lo == '\\' && j + 1 < p.size()) {
+                lo = p[++j];
+            }
+            unsigned char hi = lo;
+            if (j + 2 < p.size() && p[j + 1] == '-' && p[j + 2] != ']') {
+                hi = p[j + 2];
+                j += 2;
+            }
+            for (unsigned ch = lo; ch <= hi; ++ch) {
+                set.set(ch);
+            }
+        }
+        if (j >= p.size()) {
+            return false;
+        }
+        if (negate) {
+            set.flip();
+        }
+        if (pathname_) {
+            set.reset('/');
+        }
+        toks_.push_back({CLASS, 0, static_cast<unsigned>(classes_.size())});
+        classes_.push_back(set);
+        i = j;
+        return true;
+    }
+
+    // reach[k] 表示已匹配的记号能停在文本的第 k 个字符之前
+    bool match_general(std::string_view s) const {
+        static thread_local std::vector<char> reach, next;
+        size_t n = s.size();
+        reach.assign(n + 1, 0);
+        reach[0] = 1;
+        for (const Tok& t : toks_) {
+            next.assign(n + 1, 0);
+            bool any = false;
+            for (size_t k = 0; k <= n; ++k) {
+                if (!reach[k]) {
+                    continue;
+                }
+                switch (t.type) {
+                case CHAR:
+                    if (k < n && static_cast<unsigned char>(s[k]) == t.c) {
+                        next[k + 1] = any = true;
+                    }
+                    break;
+                case ONE:
+                    if (k < n && !(pathname_ && s[k] == '/')) {
+                        next[k + 1] = any = true;
+                    }
+                    break;
+                case CLASS:
+                    if (k < n && classes_[t.cls].test(static_cast<unsigned char>(s[k]))) {
+                        next[k + 1] = any = true;
+                    }
+                    break;
+                case STAR: // 从 k 起向后, 遇到 '/' 为止
+                    for (size_t q = k; q <= n && !next[q]; ++q) {
+                        next[q] = any = true;
+                        if (q < n && pathname_ && s[q] == '/') {
+                            break;
+                        }
+                    }
+                    break;
+                case DSTAR:
+                    for (size_t q = k; q <= n && !next[q]; ++q) {
+                        next[q] = any = true;
+                    }
+                    break;
+                case DSTAR_SLASH: // 空串, 或以 '/' 结尾的任意串
+                    next[k] = any = true;
+                    for (size_t q = k + 1; q <= n; ++q) {
+                        if (s[q - 1] == '/') {
+                            next[q] = true;
+                        }
+                    }
+                    break;
+                }
+            }
+            if (!any) {
+                return false;
+            }
+            reach.swap(next);
+        }
+        return reach[n];
+    }
+};
+
+// 以 '|' 分隔的一组模式 (-P / -I 的参数), 任意一个匹配即可
+class GlobSet {
+  public:
+    void add(std::string_view arg) {
+        size_t start = 0;
+        while (start <= arg.size()) {
+            size_t bar = arg.find('|', start);
+            if (bar == std::string_view::npos) {
+                bar = arg.size();
+            }
+            if (bar > start) {
+                globs_.emplace_back(arg.substr(start, bar - start));
+            }
+            start = bar + 1;
+        }
+    }
+
+    bool empty() const { return globs_.empty(); }
+
+    bool match(std::string_view name) const {
+        for (const auto& g : globs_) {
+            if (g.match(name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    std::vector<Glob> globs_;
+};
+
+// .gitignore -------------------------------------------------------------
+struct IgnoreRule {
+    Glob glob;
+    bool negate;
+    bool dir_only;
+    bool anchored; // 模式中带 '/': 相对 .gitignore 所在目录匹配整条路径, 否则只匹配名字
+};
+
+// 一个目录的 .gitignore 规则, 通过 parent 连到上层目录的规则; 没有 .gitignore 的目录直接沿用上层的帧.
+// 帧创建后不再修改, 并行扫描时可在线程间共享
+struct IgnoreFrame {
+    std::shared_ptr<const IgnoreFrame> parent;
+    std::string base; // .gitignore 所在目录的路径
+    std::vector<IgnoreRule> rules;
+};
+
+inline bool parse_ignore_line(std::string_view line, IgnoreFrame& frame) {
+    while (!line.empty() && (line.back() == '\r' || (line.back() == ' ' && !(line.size() >= 2 &&
+                                                                             line[line.size() - 2] == '\\')))) {
+        line.remove_suffix(1);
+    }
+    if (line.empty() || line[0] == '#') {
+        return false;
+    }
+    bool negate = line[0] == '!';
+    if (negate) {
+        line.remove_prefix(1);
+    } else if (line.size() >= 2 && line[0] == '\\' && (line[1] == '#' || line[1] == '!')) {
+        line.remove_prefix(1);
+    }
+    bool dir_only = !line.empty() && line.back() == '/';
+    if (dir_only) {
+        line.remove_suffix(1);
+    }
+    if (line.empty()) {
+        return false;
+    }
+    bool anchored = line.find('/') != std::string_view::npos;
+    if (anchored && line[0] == '/') {
+        line.remove_prefix(1);
+    }
+    frame.rules.push_back(IgnoreRule{Glob(line, anchored), negate, dir_only, anchored});
+    return true;
+}
+
+// 读取 dir/.gitignore; 不存在或没有有效规则时返回 parent 本身
+inline std::shared_ptr<const IgnoreFrame> load_ignore(const std::string& dir,
+                                                      std::shared_ptr<const IgnoreFrame> parent) {
+    std::string file = dir;
+    if (!file.empty() && file.back() != '/') {
+        file += '/';
+    }
+    file += ".gitignore";
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return parent;
+    }
+    std::string text;
+    char buf[8192];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) {
+            text.append(buf, n);
+        }
+    }
+    close(fd);
+    auto frame = std::make_shared<IgnoreFrame>();
+    frame->base = dir;
+    std::string_view rest = text;
+    while (!rest.empty()) {
+        size_t nl = rest.find('\n');
+        parse_ignore_line(rest.substr(0, nl), *frame);
+        rest.remove_prefix(nl == std::string_view::npos ? rest.size() : nl + 1);
+    }
+    if (frame->rules.empty()) {
+        return parent;
+    }
+    frame->parent = std::move(parent);
+    return frame;
+}
+
+// dir 下名为 name 的目录项是否被忽略: 从最深的 .gitignore 开始, 每个文件内后面的规则优先, 第一条匹配的规则决定结果
+inline bool is_ignored(const IgnoreFrame* frame, std::string_view dir, std::string_view name, bool is_dir) {
+    if (name == ".git") {
+        return true;
+    }
+    static thread_local std::string rel;
+    for (; frame; frame = frame->parent.get()) {
+        bool have_rel = false;
+        for (auto it = frame->rules.rbegin(); it != frame->rules.rend(); ++it) {
+            if (it->dir_only && !is_dir) {
+                continue;
+            }
+            bool hit;
+            if (it->anchored) {
+                if (!have_rel) { // dir 一定以 base 开头 (路径都由 base 逐级拼出)
+                    std::string_view sub = dir.substr(std::min(dir.size(), frame->base.size()));
+                    while (!sub.empty() && sub[0] == '/') {
+                        sub.remove_prefix(1);
+                    }
+                    rel.assign(sub);
+                    if (!rel.empty()) {
+                        rel += '/';
+                    }
+                    rel.append(name);
+                    have_rel = true;
+                }
+                hit = it->glob.match(rel);
+            } else {
+                hit = it->glob.match(name);
+            }
+            if (hit) {
+                return !it->negate;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+// 直接用 getdents64 读目录: 一次系统调用取回一整块目录项, 每项自带 d_type,
+// 绝大多数文件系统上不需要再 stat 就能知道类型. 只有 d_type 为 DT_UNKNOWN, 需要跟随符号链接,
+// 或者上色需要权限位时才对单个目录项做一次 fstatat.
+
+// --stats 输出的系统调用计数, 并行扫描时由多个线程累加
+struct SyscallStats {
+    std::atomic<size_t> open{0};
+    std::atomic<size_t> getdents{0};
+    std::atomic<size_t> fstatat{0};
+    std::atomic<size_t> statx{0};
+    std::atomic<size_t> close{0};
+    std::atomic<size_t> fallback{0}; // 退回 std::filesystem 扫描的目录数
+    std::atomic<size_t> uring_enter{0};
+    std::atomic<size_t> uring_statx{0}; // 经 io_uring 提交的 statx 请求数
+};
+inline SyscallStats syscall_stats;
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+#define GETDENTS_BUF (32 * 1024)
+
+inline int counted_fstatat(int dirfd, const char* name, struct stat* st, int flags) {
+    syscall_stats.fstatat++;
+    return fstatat(dirfd, name, st, flags);
+}
+
+// --du 只取需要的字段, 并允许使用缓存的属性 (网络文件系统上不会为此同步)
+inline int counted_statx(int dirfd, const char* name, unsigned mask, struct statx* stx) {
+    syscall_stats.statx++;
+    return statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, stx);
+}
+
+// 对目录 (相对 atfd 的 path) 中的每一项 (不含 . 和 ..) 调用 fn(name, d_type, dirfd), fn 返回 false 时提前结束.
+// 每处理完一次 getdents64 取回的一块目录项调用 flush(dirfd), 此时这一块的名字仍然有效, 可以批量处理;
+// flush 返回 false 同样提前结束.
+// 打不开目录, 读目录出错或 fn/flush 中止时返回 false, errno 为相应的错误
+template <typename F, typename Flush>
+bool read_dir(int atfd, const char* path, F&& fn, Flush&& flush) {
+    syscall_stats.open++;
+    int fd = openat(atfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    alignas(linux_dirent64) char buf[GETDENTS_BUF];
+    bool ok = true;
+    while (ok) {
+        syscall_stats.getdents++;
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        for (long off = 0; off < n;) {
+            auto* d = reinterpret_cast<linux_dirent64*>(buf + off);
+            off += d->d_reclen;
+            const char* name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            if (!fn(name, d->d_type, fd)) {
+                ok = false;
+                break;
+            }
+        }
+        if (ok && !flush(fd)) {
+            ok = false;
+        }
+    }
+    int saved = errno;
+    syscall_stats.close++;
+    ::close(fd);
+    errno = saved;
+    return ok;
+}
+
+template <typename F>
+bool read_dir(int atfd, const char* path, F&& fn) {
+    return read_dir(atfd, path, std::forward<F>(fn), [](int) { return true; });
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// 标准输出的缓冲层: 每行直接拼进一块大缓冲区, 写满或退出时才 write 一次,
+// 代替 std::cout << ... << std::endl 每行一次 flush (一个文件一次系统调用).
+// 标准输出是终端时按行刷新, 与 stdio 的行缓冲一致.
+// 标准输出是管道时用 vmsplice(SPLICE_F_GIFT) 把整页缓冲区直接交给管道, 省掉一次拷贝;
+// 交出去的页不能再改写, 所以每次交出后换一块新映射的缓冲区. vmsplice 失败时退回 write.
+class Output {
+  public:
+    static constexpr size_t BUF_SIZE = 1 << 20;
+
+    Output() {
+        struct stat st;
+        if (isatty(STDOUT_FILENO)) {
+            line_buffered_ = true;
+        } else if (fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            splice_ = true;
+        }
+        map_buf();
+    }
+
+    ~Output() { flush(); }
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    void put(const char* s, size_t n) {
+        if (n > BUF_SIZE - len_) {
+            flush();
+            if (n > BUF_SIZE) { // 单次超过缓冲区大小时直接写出
+                write_all(s, n);
+                return;
+            }
+        }
+        std::memcpy(buf_ + len_, s, n);
+        len_ += n;
+    }
+
+    void put(std::string_view s) { put(s.data(), s.size()); }
+
+    void put(char c) {
+        if (len_ == BUF_SIZE) {
+            flush();
+        }
+        buf_[len_++] = c;
+    }
+
+    void put_num(size_t v) {
+        char tmp[24];
+        char* p = tmp + sizeof(tmp);
+        do {
+            *--p = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v);
+        put(p, tmp + sizeof(tmp) - p);
+    }
+
+    // 行尾: 终端上立即刷新
+    void end_line() {
+        put('\n');
+        if (line_buffered_) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (len_ == 0) {
+            return;
+        }
+        if (splice_ && gift()) {
+            map_buf();
+        } else {
+            write_all(buf_, len_);
+        }
+        len_ = 0;
+    }
+
+  private:
+    char* buf_ = nullptr;
+    size_t len_ = 0;
+    bool line_buffered_ = false;
+    bool splice_ = false;
+
+    void map_buf() {
+        void* p = mmap(nullptr, BUF_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            static char fallback[BUF_SIZE]; // 映射失败时改用静态缓冲区, 不再 vmsplice
+            buf_ = fallback;
+            splice_ = false;
+            return;
+        }
+        buf_ = static_cast<char*>(p);
+    }
+
+    // 把当前缓冲区整体交给管道; 已交出一部分后出错时用 write 补完剩余部分
+    bool gift() {
+        struct iovec iov = {buf_, len_};
+        while (iov.iov_len > 0) {
+            ssize_t n = vmsplice(STDOUT_FILENO, &iov, 1, SPLICE_F_GIFT);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (iov.iov_base == buf_) { // 一页都没交出, 缓冲区仍可复用
+                    splice_ = false;
+                    return false;
+                }
+                write_all(static_cast<char*>(iov.iov_base), iov.iov_len);
+                splice_ = false;
+                break;
+            }
+            iov.iov_base = static_cast<char*>(iov.iov_base) + n;
+            iov.iov_len -= n;
+        }
+        munmap(buf_, BUF_SIZE); // 已在管道中的页由内核持有引用, 解除映射不影响读端
+        return true;
+    }
+
+    static void write_all(const char* s, size_t n) {
+        while (n > 0) {
+            ssize_t w = write(STDOUT_FILENO, s, n);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            s += w;
+            n -= w;
+        }
+    }
+};
+
+inline Output out;
@@ -1,17 +1,37 @@
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <clocale>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <filesystem>
 #include <iostream>
 #include <locale>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/sysmacros.h>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
-#define COLOR_DIR   "\033[1;34m" // 目录      （粗体蓝色）
-#define COLOR_FILE  "\033[0m"    // 文件      （默认）
-#define COLOR_EXE   "\033[1;32m" // 可执行文件（粗体绿色）
-#define COLOR_LINK  "\033[1;36m" // 符号链接  （粗体青色）
-#define COLOR_RESET "\033[0m"    // 重置颜色
+#include "colors.h"
+#include "filter.h"
+#include "getdents.h"
+#include "output.h"
+#include "uring.h"
+
+#define COLOR_RESET "\033[0m"    // 重置颜色 (错误信息前)
 
 namespace fs = std::filesystem;
 
@@ -19,105 +39,1768 @@ struct Config {
     int max_level = 1;
     bool show_color = false;
     bool show_error = true;
+    int jobs = 0; // -j N: 并行扫描的线程数, 0 表示单线程递归
+    bool show_stats = false; // --stats: 结束时输出系统调用计数
+    enum { TEXT, JSON, NDJSON } format = TEXT; // -J: 嵌套 JSON, --ndjson: 每个目录项一行 JSON
+    bool du = false;    // --du: 显示每个目录 (含子树) 的大小, 兄弟项按大小排序
+    bool human = false; // -h: 大小用 K/M/G 单位
+    GlobSet include;        // -P: 只列出名字匹配的文件 (目录总是列出)
+    GlobSet exclude;        // -I: 不列出名字匹配的文件和目录, 被排除的目录不会被打开
+    bool gitignore = false; // --gitignore: 按各级 .gitignore 排除
+    bool follow = false;    // -l: 展开符号链接目录时检测环路
+    bool io_uring = false;  // --io-uring: 每个目录块的 statx 经 io_uring 批量提交
+
+    bool need_meta() const { return format != TEXT; } // 是否需要每个目录项的 lstat 信息
 };
 
-// 统计结构
+// 统计结构: 并行模式下由多个线程在扫描时累加
 struct Stats {
-    size_t dirs = 0;
-    size_t files = 0;
+    std::atomic<size_t> dirs{0};
+    std::atomic<size_t> files{0};
 } stats;
 
-std::string get_color(const fs::path& path) {
-    try {
-        if (fs::is_symlink(path))
-            return COLOR_LINK;
-        else if (fs::is_directory(path))
-            return COLOR_DIR;
-        else if (fs::is_regular_file(path)) {
-#ifndef _WIN32
-            auto perms = fs::status(path).permissions();
-            if ((perms & (fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec)) != fs::perms::none) {
-                return COLOR_EXE;
+// 颜色在目录项中只存一个字节的编号 (ls_colors 的颜色表下标)
+constexpr uint8_t C_NONE = LsColors::NONE;
+
+// 按路径上色 (std::filesystem 后端和链接目标用), 需要 lstat, 链接还要 stat 一次目标
+uint8_t get_color(const fs::path& path) {
+    struct stat lst, st;
+    if (counted_fstatat(AT_FDCWD, path.c_str(), &lst, AT_SYMLINK_NOFOLLOW) != 0) {
+        return ls_colors.color(path.filename().native(), DT_UNKNOWN, false, 0, 1, true, 0);
+    }
+    bool link_ok = true;
+    uint32_t target_mode = 0;
+    if (S_ISLNK(lst.st_mode)) {
+        link_ok = counted_fstatat(AT_FDCWD, path.c_str(), &st, 0) == 0;
+        target_mode = link_ok ? st.st_mode : 0;
+    }
+    return ls_colors.color(path.filename().native(), DT_UNKNOWN, true, lst.st_mode, lst.st_nlink, link_ok,
+                           target_mode);
+}
+
+// 一个目录项在输出时需要的全部信息, 扫描时一次取齐, 输出阶段不再访问文件系统.
+// 名字和链接目标都存放在所属 Listing 的 arena 中, 记录本身只有 16 字节; 完整路径只在需要时拼出
+struct Entry {
+    enum : uint8_t { DIR = 1, LINK = 2, BROKEN = 4, RECURSIVE = 8 }; // RECURSIVE: -l 时指向上层目录的链接
+    uint32_t name;       // 名字在 arena 中的偏移
+    uint32_t target;     // 符号链接目标的偏移
+    uint16_t name_len;
+    uint16_t target_len; // 读取失败时为 0
+    uint8_t flags;
+    uint8_t color;       // -C 时的颜色
+    uint8_t target_color;
+    uint8_t type;        // d_type, 快照命中时据此决定哪些项要重新 stat
+
+    bool is_dir() const { return flags & DIR; }
+    bool is_link() const { return flags & LINK; }
+    bool broken() const { return flags & BROKEN; }
+    bool recursive() const { return flags & RECURSIVE; }
+};
+static_assert(sizeof(Entry) == 16, "Entry should stay compact");
+
+// 目录项本身 (不跟随链接) 的 lstat 信息, 只在 JSON 输出时收集
+struct Meta {
+    uint64_t size;
+    uint64_t blocks; // 只有 --du 时填写
+    uint32_t mode;
+};
+
+// 一个目录的扫描结果: 排好序的目录项, 或者一条错误信息.
+// 串行模式下每层复用同一个 Listing, 清空时保留 entries 与 arena 的容量
+struct Listing {
+    std::vector<Entry> entries;
+    std::vector<Meta> meta; // 为空或与 entries 一一对应
+    std::vector<char> arena;
+    std::string error;
+    bool failed = false;
+    bool dropped_link = false; // 有符号链接因不是目录被 -P 滤掉: 目标改变后可能应当显示, 不写入快照
+
+    std::string_view name(const Entry& e) const { return {arena.data() + e.name, e.name_len}; }
+    std::string_view target(const Entry& e) const { return {arena.data() + e.target, e.target_len}; }
+
+    uint32_t intern(std::string_view s) {
+        uint32_t off = arena.size();
+        arena.insert(arena.end(), s.begin(), s.end());
+        return off;
+    }
+
+    void add(std::string_view name, uint8_t flags, uint8_t color, unsigned char type = DT_UNKNOWN) {
+        entries.push_back(
+            Entry{intern(name), 0, static_cast<uint16_t>(name.size()), 0, flags, color, C_NONE, type});
+    }
+
+    void clear() {
+        entries.clear();
+        meta.clear();
+        arena.clear();
+        error.clear();
+        failed = false;
+        dropped_link = false;
+    }
+};
+
+fs::path child_path(const fs::path& dir, std::string_view name) { return dir / name; }
+
+// 路径锚点: 很深的目录路径会超过 PATH_MAX, 串行遍历每深入 ANCHOR_SPAN 字节就打开一个目录作为锚点,
+// 之后的系统调用用相对锚点的路径 (*at 系列). 锚点按线程记录, 并行遍历时由子目录共享 (SharedAnchor)
+#define ANCHOR_SPAN 2048
+
+struct PathAnchor {
+    int fd = AT_FDCWD;
+    size_t len = 0; // 锚点目录路径的长度, 更深的路径都以它为前缀
+};
+thread_local PathAnchor path_anchor;
+
+// 把 path 转成 (fd, 相对路径)
+const char* at_path(const std::string& path, int& fd) {
+    if (path_anchor.fd == AT_FDCWD || path.size() < path_anchor.len) {
+        fd = AT_FDCWD;
+        return path.c_str();
+    }
+    const char* rel = path.c_str() + path_anchor.len;
+    while (*rel == '/') {
+        ++rel;
+    }
+    fd = path_anchor.fd;
+    return *rel ? rel : ".";
+}
+
+// 以 path 目录为新锚点; 相对当前锚点的路径还不够长时什么也不做, 返回 -1
+int open_anchor(const std::string& path) {
+    if (path.size() - path_anchor.len <= ANCHOR_SPAN) {
+        return -1;
+    }
+    int atfd;
+    const char* rel = at_path(path, atfd);
+    return openat(atfd, rel, O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+// 文件或目录的身份
+struct DevIno {
+    uint64_t dev, ino;
+    bool operator==(const DevIno& o) const { return dev == o.dev && ino == o.ino; }
+};
+struct DevInoHash {
+    size_t operator()(const DevIno& k) const { return k.ino * 0x9e3779b97f4a7c15ULL ^ k.dev; }
+};
+
+// 排序键: 最高位为 0 表示目录 (排在前面), 低 56 位为名字的前 7 个字节 (大端, 不足补 0).
+// 名字中没有 '\0', 所以键的大小顺序与 (目录在前, 名字按字节序) 一致, 键相同时才比较完整名字
+struct SortKey {
+    uint64_t key;
+    uint32_t idx;
+};
+
+uint64_t sort_key(const Entry& e, const char* name) {
+    uint64_t k = e.is_dir() ? 0 : 1ULL << 63;
+    size_t n = std::min<size_t>(e.name_len, 7);
+    for (size_t i = 0; i < n; ++i) {
+        k |= uint64_t(static_cast<unsigned char>(name[i])) << (48 - 8 * i);
+    }
+    return k;
+}
+
+// 对键做 LSD 基数排序 (所有项该字节都相同的轮次跳过), 再对键相同的区间按完整名字排序.
+// 小目录直接用 std::sort
+void sort_entries(Listing& listing) {
+    static thread_local std::vector<SortKey> keys, tmp;
+    static thread_local std::vector<Entry> sorted;
+    static thread_local std::vector<Meta> sorted_meta;
+    auto& entries = listing.entries;
+    size_t n = entries.size();
+    keys.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = {sort_key(entries[i], listing.arena.data() + entries[i].name), static_cast<uint32_t>(i)};
+    }
+    auto by_name = [&](const SortKey& a, const SortKey& b) {
+        if (a.key != b.key) {
+            return a.key < b.key;
+        }
+        return listing.name(entries[a.idx]) < listing.name(entries[b.idx]);
+    };
+    if (n < 256) {
+        std::sort(keys.begin(), keys.end(), by_name);
+    } else {
+        tmp.resize(n);
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t count[257] = {0};
+            for (const auto& k : keys) {
+                count[((k.key >> shift) & 0xff) + 1]++;
+            }
+            if (count[((keys[0].key >> shift) & 0xff) + 1] == n) {
+                continue;
             }
-#endif
-            return COLOR_EXE;
+            for (int b = 0; b < 256; ++b) {
+                count[b + 1] += count[b];
+            }
+            for (const auto& k : keys) {
+                tmp[count[(k.key >> shift) & 0xff]++] = k;
+            }
+            keys.swap(tmp);
+        }
+        for (size_t i = 0; i < n;) {
+            size_t j = i + 1;
+            while (j < n && keys[j].key == keys[i].key) {
+                ++j;
+            }
+            if (j - i > 1) {
+                std::sort(keys.begin() + i, keys.begin() + j, by_name);
+            }
+            i = j;
         }
-    } catch (...) {
     }
-    return COLOR_FILE;
+    sorted.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        sorted[i] = entries[keys[i].idx];
+    }
+    entries.swap(sorted);
+    if (!listing.meta.empty()) {
+        sorted_meta.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            sorted_meta[i] = listing.meta[keys[i].idx];
+        }
+        listing.meta.swap(sorted_meta);
+    }
+}
+
+// 排序 (目录在前，文件在后，按字母序), 读取符号链接目标并累加统计
+void finish_listing(const fs::path& path, Listing& listing, const Config& config) {
+    sort_entries(listing);
+    size_t dirs = 0;
+    for (auto& e : listing.entries) {
+        if (e.is_dir()) {
+            dirs++;
+        } else if (e.is_link() && e.target_len == 0) {
+            try {
+                auto target = fs::read_symlink(child_path(path, listing.name(e)));
+                std::string t = target.string();
+                e.target = listing.intern(t);
+                e.target_len = t.size();
+                if (config.show_color) {
+                    e.target_color = get_color(target);
+                }
+            } catch (const fs::filesystem_error&) {
+                e.flags |= Entry::BROKEN;
+            }
+        }
+    }
+    stats.dirs += dirs;
+    stats.files += listing.entries.size() - dirs;
+}
+
+// 已经排好序的 Listing (来自快照) 只需要累加统计
+void count_listing(const Listing& listing) {
+    size_t dirs = 0;
+    for (const auto& e : listing.entries) {
+        dirs += e.is_dir();
+    }
+    stats.dirs += dirs;
+    stats.files += listing.entries.size() - dirs;
 }
 
-void print_tree(const fs::path& path, const Config& config, int current_level = 0, const std::string& prefix = "") {
-    if (current_level > config.max_level) {
+// 按 d_type 上色, 只有 LS_COLORS 用到的信息 d_type 给不出时 (执行位, setuid, 粘滞位, 硬链接数, DT_UNKNOWN)
+// 才 fstatat. 符号链接的 link_ok/target_mode 来自判断是否目录时已做的 stat
+uint8_t color_of(unsigned char type, int dirfd, const char* name, bool link_ok, uint32_t target_mode) {
+    struct stat st;
+    bool have = ls_colors.needs_stat(type) && counted_fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    return ls_colors.color(name, type, have, have ? st.st_mode : 0, have ? st.st_nlink : 1, link_ok, target_mode);
+}
+
+// 为刚加入的目录项记录 lstat 信息 (ok 为 false 表示取不到); 符号链接同时读出目标
+void record_meta(Listing& listing, int dirfd, const char* name, bool ok, uint64_t size, uint32_t mode) {
+    if (!ok) {
+        listing.meta.push_back(Meta{0, 0, 0});
         return;
     }
+    listing.meta.push_back(Meta{size, 0, mode});
+    if (S_ISLNK(mode)) {
+        char buf[PATH_MAX];
+        ssize_t n = readlinkat(dirfd, name, buf, sizeof(buf));
+        Entry& e = listing.entries.back();
+        e.flags |= Entry::LINK;
+        if (n > 0) {
+            e.target = listing.intern(std::string_view(buf, n));
+            e.target_len = n;
+        } else {
+            e.flags |= Entry::BROKEN;
+        }
+    }
+}
+
+void add_meta(Listing& listing, int dirfd, const char* name) {
+    struct stat st;
+    bool ok = counted_fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    record_meta(listing, dirfd, name, ok, ok ? st.st_size : 0, ok ? st.st_mode : 0);
+}
+
+// 本线程的 io_uring; 没有 --io-uring 或 io_uring 不可用时返回 nullptr, 调用者逐项同步 stat
+StatxBatch* statx_batch(const Config& config) {
+    if (!config.io_uring) {
+        return nullptr;
+    }
+    thread_local std::unique_ptr<StatxBatch> ring(new StatxBatch());
+    return ring->ok() ? ring.get() : nullptr;
+}
+
+// 一个目录块中等待批量 statx 的目录项; name 指向 getdents64 的缓冲区, 只在 flush 期间有效
+struct PendingStat {
+    const char* name;
+    unsigned char type;
+    bool keep;
+    bool is_dir;
+    int follow_res; // 跟随链接的 statx (判断是否目录)
+    int lstat_res;  // 不跟随链接的 statx (上色, 元数据, --du)
+    struct statx follow;
+    struct statx lstat;
+};
+thread_local std::vector<PendingStat> pending_stats;
+
+// 过滤: 在读目录时判断, 被排除的目录不进入列表, 也就不会被打开.
+// ignore 为当前目录生效的 .gitignore 规则 (没有 --gitignore 时为空)
+bool keep(const Config& config, const IgnoreFrame* ignore, const fs::path& dir, std::string_view name, bool is_dir) {
+    if (!config.exclude.empty() && config.exclude.match(name)) {
+        return false;
+    }
+    if (config.gitignore && is_ignored(ignore, dir.native(), name, is_dir)) {
+        return false;
+    }
+    return is_dir || config.include.empty() || config.include.match(name);
+}
+
+// 当前目录生效的 .gitignore 规则帧, parent 为上层目录的
+std::shared_ptr<const IgnoreFrame> ignore_for(const fs::path& dir, const Config& config,
+                                              std::shared_ptr<const IgnoreFrame> parent) {
+    return config.gitignore ? load_ignore(dir.native(), std::move(parent)) : nullptr;
+}
+
+// --io-uring: 与 scan_dir_raw 的逐项版本结果相同, 但一个目录块的 stat 分两批提交:
+// 先是判断链接是否指向目录的 statx (过滤需要知道是否目录), 再是通过过滤的目录项需要的 lstat.
+// 链接目标仍用 readlinkat 同步读取 (io_uring 没有对应的操作)
+bool scan_dir_uring(const fs::path& path, const Config& config, const IgnoreFrame* ignore, Listing& listing,
+                    StatxBatch& ring, int atfd, const char* rel) {
+    constexpr unsigned mask = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_SIZE;
+    pending_stats.clear();
+    auto collect = [&](const char* name, unsigned char type, int) {
+        pending_stats.push_back(PendingStat{name, type, false, type == DT_DIR, 0, 0, {}, {}});
+        return true;
+    };
+    auto flush = [&](int dirfd) {
+        for (auto& p : pending_stats) {
+            if (p.type == DT_LNK || p.type == DT_UNKNOWN) { // 与 directory_entry::status() 一样跟随链接
+                syscall_stats.uring_statx++;
+                ring.add(dirfd, p.name, 0, STATX_TYPE | STATX_MODE, &p.follow, &p.follow_res);
+            }
+        }
+        ring.run();
+        bool lstat = false;
+        for (auto& p : pending_stats) {
+            if (p.type == DT_LNK || p.type == DT_UNKNOWN) {
+                if (p.follow_res == 0) {
+                    p.is_dir = S_ISDIR(p.follow.stx_mode);
+                } else if (p.follow_res != -ENOENT && p.follow_res != -ENOTDIR) {
+                    errno = -p.follow_res;
+                    return false;
+                }
+            }
+            p.keep = keep(config, ignore, path, p.name, p.is_dir);
+            listing.dropped_link |= !p.keep && !p.is_dir && (p.type == DT_LNK || p.type == DT_UNKNOWN);
+            if (p.keep && (config.need_meta() || (config.show_color && ls_colors.needs_stat(p.type)))) {
+                syscall_stats.uring_statx++;
+                ring.add(dirfd, p.name, AT_SYMLINK_NOFOLLOW, mask, &p.lstat, &p.lstat_res);
+                lstat = true;
+            } else {
+                p.lstat_res = -EINVAL;
+            }
+        }
+        if (lstat) {
+            ring.run();
+        }
+        for (const auto& p : pending_stats) {
+            if (!p.keep) {
+                continue;
+            }
+            bool ok = p.lstat_res == 0;
+            uint8_t color = config.show_color ? ls_colors.color(p.name, p.type, ok, p.lstat.stx_mode, p.lstat.stx_nlink,
+                                                                p.follow_res == 0, p.follow.stx_mode)
+                                              : C_NONE;
+            listing.add(p.name, p.is_dir ? Entry::DIR : 0, color, p.type);
+            if (config.need_meta()) {
+                record_meta(listing, dirfd, p.name, ok, p.lstat.stx_size, p.lstat.stx_mode);
+            }
+        }
+        pending_stats.clear();
+        return true;
+    };
+    return read_dir(atfd, rel, collect, flush);
+}
+
+// getdents64 后端. 遇到 std::filesystem 会报错的情况 (打不开目录, 跟随链接时出现
+// ENOENT/ENOTDIR 以外的错误) 返回 false, 由调用者退回 std::filesystem 以输出相同的错误信息
+bool scan_dir_raw(const fs::path& path, const Config& config, const IgnoreFrame* ignore, Listing& listing) {
+    int atfd;
+    const char* rel = at_path(path.native(), atfd);
+    if (StatxBatch* ring = statx_batch(config)) {
+        return scan_dir_uring(path, config, ignore, listing, *ring, atfd, rel);
+    }
+    return read_dir(atfd, rel, [&](const char* name, unsigned char type, int dirfd) {
+        bool is_dir = false;
+        bool link_ok = false;
+        uint32_t target_mode = 0;
+        if (type == DT_DIR) {
+            is_dir = true;
+        } else if (type == DT_LNK || type == DT_UNKNOWN) { // 与 directory_entry::status() 一样跟随链接
+            struct stat st;
+            if (counted_fstatat(dirfd, name, &st, 0) == 0) {
+                is_dir = S_ISDIR(st.st_mode);
+                link_ok = true;
+                target_mode = st.st_mode;
+            } else if (errno != ENOENT && errno != ENOTDIR) {
+                return false;
+            }
+        }
+        if (!keep(config, ignore, path, name, is_dir)) {
+            listing.dropped_link |= !is_dir && (type == DT_LNK || type == DT_UNKNOWN);
+            return true;
+        }
+        uint8_t color = config.show_color ? color_of(type, dirfd, name, link_ok, target_mode) : C_NONE;
+        listing.add(name, is_dir ? Entry::DIR : 0, color, type);
+        if (config.need_meta()) {
+            add_meta(listing, dirfd, name);
+        }
+        return true;
+    });
+}
+
+// std::filesystem 后端
+void scan_dir_fs(const fs::path& path, const Config& config, const IgnoreFrame* ignore, Listing& listing) {
     try {
-        std::vector<fs::directory_entry> entries;
         for (const auto& entry : fs::directory_iterator(path)) {
             std::string filename = entry.path().filename().string();
             if (filename == "." || filename == "..") {
                 continue;
             }
-            entries.push_back(entry);
+            auto st = entry.status();
+            if (!keep(config, ignore, path, filename, fs::is_directory(st))) {
+                listing.dropped_link |= !fs::is_directory(st);
+                continue;
+            }
+            uint8_t flags = (fs::is_directory(st) ? Entry::DIR : 0) | (fs::is_symlink(st) ? Entry::LINK : 0);
+            listing.add(filename, flags, config.show_color ? get_color(entry.path()) : C_NONE);
+            if (config.need_meta()) {
+                add_meta(listing, AT_FDCWD, entry.path().c_str());
+            }
+        }
+    } catch (const fs::filesystem_error& e) {
+        listing.clear();
+        listing.error = e.what();
+        listing.failed = true;
+    }
+}
+
+// 快照缓存 (--cache DIR) ---------------------------------------------------
+// 每个起始目录一个快照文件, 里面是上次扫描过的每个目录排好序的 Listing, 以目录的 (dev, ino) 为键并记下其 mtime.
+// 再次扫描时先 stat 目录: mtime 没变 (目录中没有增删改名) 就直接用快照, 不再 getdents 和排序.
+// 目录 mtime 只反映名字与 d_type, 所以命中后仍要重新 stat 符号链接 (是否指向目录) 和 -C 需要权限位的目录项.
+// 为避免同一时间刻内的修改被漏掉, mtime 距扫描开始不到 2 秒的目录不写入快照.
+// 文件格式: SnapHeader, 然后是若干条 SnapRecord, 每条之后紧跟 nent 个 Entry 和 alen 字节的 arena (补齐到 8 字节)
+struct SnapHeader {
+    char magic[8];
+    uint64_t fingerprint; // 影响 Listing 内容的选项 (-C, -P, -I), 不同时整个快照作废
+    uint64_t count;
+};
+
+struct SnapRecord {
+    uint64_t dev, ino;
+    int64_t sec, nsec; // 目录的 mtime
+    uint32_t nent, alen;
+};
+
+struct DirKey {
+    DevIno id{0, 0};
+    int64_t sec = 0, nsec = 0;
+    bool valid = false;
+};
+
+class SnapshotCache {
+  public:
+    SnapshotCache(std::string file, uint64_t fingerprint) : file_(std::move(file)), fingerprint_(fingerprint) {
+        start_ = std::time(nullptr);
+        load();
+    }
+
+    // stat 目录得到它的键; 快照中有 mtime 相同的记录时填入 listing 并返回 true
+    bool lookup(const fs::path& path, Listing& listing, DirKey& key) {
+        struct stat st;
+        int atfd;
+        const char* rel = at_path(path.native(), atfd);
+        if (counted_fstatat(atfd, rel, &st, 0) != 0) {
+            return false;
+        }
+        key = {{st.st_dev, st.st_ino}, st.st_mtim.tv_sec, st.st_mtim.tv_nsec, true};
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = index_.find(key.id);
+        if (it == index_.end()) {
+            return false;
+        }
+        const SnapRecord* r = record(it->second);
+        if (r->sec != key.sec || r->nsec != key.nsec) {
+            return false;
+        }
+        const char* p = reinterpret_cast<const char*>(r + 1);
+        listing.clear();
+        listing.entries.resize(r->nent);
+        std::memcpy(listing.entries.data(), p, r->nent * sizeof(Entry));
+        listing.arena.assign(p + r->nent * sizeof(Entry), p + r->nent * sizeof(Entry) + r->alen);
+        hits_++;
+        return true;
+    }
+
+    // 记录本次扫描的结果; 已有同一目录的记录时替换
+    void store(const DirKey& key, const Listing& listing) {
+        if (!key.valid || key.sec >= start_ - 2 || listing.dropped_link) {
+            return;
+        }
+        std::lock_guard<std::mutex> lk(mtx_);
+        size_t off = data_.size();
+        SnapRecord r{key.id.dev, key.id.ino, key.sec, key.nsec, static_cast<uint32_t>(listing.entries.size()),
+                     static_cast<uint32_t>(listing.arena.size())};
+        append(&r, sizeof(r));
+        append(listing.entries.data(), listing.entries.size() * sizeof(Entry));
+        append(listing.arena.data(), listing.arena.size());
+        data_.resize((data_.size() + 7) & ~size_t(7));
+        auto [it, fresh] = index_.emplace(key.id, off);
+        if (!fresh) {
+            it->second = off;
+        }
+        dirty_ = true;
+    }
+
+    // --watch: 目录中有文件属性变化 (不改变目录 mtime) 时丢弃其记录
+    void invalidate(const DevIno& id) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        dirty_ |= index_.erase(id) > 0;
+    }
+
+    // 新一轮扫描开始 (--watch 每次重画)
+    void begin_scan() { start_ = std::time(nullptr); }
+
+    // 只保留仍被索引引用的记录 (压缩内存中的数据), 写入临时文件后改名
+    void save() {
+        if (!dirty_) {
+            return;
+        }
+        std::vector<char> buf;
+        SnapHeader h{};
+        std::memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+        h.fingerprint = fingerprint_;
+        h.count = index_.size();
+        buf.insert(buf.end(), reinterpret_cast<char*>(&h), reinterpret_cast<char*>(&h + 1));
+        for (auto& [id, off] : index_) {
+            const SnapRecord* r = record(off);
+            size_t len = (sizeof(SnapRecord) + r->nent * sizeof(Entry) + r->alen + 7) & ~size_t(7);
+            size_t at = buf.size();
+            buf.insert(buf.end(), data_.data() + off, data_.data() + off + len);
+            off = at;
+        }
+        data_.swap(buf);
+        if (file_.empty()) { // 只有 --watch, 快照只在内存中
+            return;
+        }
+        std::string tmp = file_ + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return;
+        }
+        const std::vector<char>& buf_out = data_;
+        bool ok = true;
+        for (size_t done = 0; ok && done < buf_out.size();) {
+            ssize_t n = write(fd, buf_out.data() + done, buf_out.size() - done);
+            ok = n > 0 || (n < 0 && errno == EINTR);
+            done += n > 0 ? n : 0;
+        }
+        ok = close(fd) == 0 && ok;
+        if (ok && rename(tmp.c_str(), file_.c_str()) == 0) {
+            dirty_ = false;
+        } else {
+            unlink(tmp.c_str());
+        }
+    }
+
+    size_t hits() const { return hits_; }
+
+  private:
+    static constexpr char SNAP_MAGIC[8] = {'T', 'R', 'E', 'E', 'S', 'N', 'P', '2'};
+
+    std::string file_;
+    uint64_t fingerprint_;
+    int64_t start_;
+    std::mutex mtx_;
+    std::vector<char> data_; // 读入的快照与本次新增的记录, 按 8 字节对齐
+    std::unordered_map<DevIno, size_t, DevInoHash> index_;
+    std::atomic<size_t> hits_{0};
+    bool dirty_ = false;
+
+    const SnapRecord* record(size_t off) const { return reinterpret_cast<const SnapRecord*>(data_.data() + off); }
+
+    void append(const void* p, size_t n) {
+        const char* c = static_cast<const char*>(p);
+        data_.insert(data_.end(), c, c + n);
+    }
+
+    // 读入整个快照并建立索引; 格式不对或选项不同则当作没有快照
+    void load() {
+        int fd = file_.empty() ? -1 : open(file_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(SnapHeader))) {
+            data_.resize(st.st_size);
+            size_t done = 0;
+            while (done < data_.size()) {
+                ssize_t n = read(fd, data_.data() + done, data_.size() - done);
+                if (n <= 0 && !(n < 0 && errno == EINTR)) {
+                    break;
+                }
+                done += n > 0 ? n : 0;
+            }
+            data_.resize(done);
+        }
+        close(fd);
+        SnapHeader h{};
+        if (data_.size() >= sizeof(h)) {
+            std::memcpy(&h, data_.data(), sizeof(h));
+        }
+        if (std::memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) != 0 || h.fingerprint != fingerprint_) {
+            data_.clear();
+            return;
+        }
+        size_t off = sizeof(SnapHeader);
+        for (uint64_t i = 0; i < h.count && off + sizeof(SnapRecord) <= data_.size(); ++i) {
+            const SnapRecord* r = record(off);
+            size_t len = (sizeof(SnapRecord) + r->nent * sizeof(Entry) + size_t(r->alen) + 7) & ~size_t(7);
+            if (off + len > data_.size()) {
+                break;
+            }
+            index_[DevIno{r->dev, r->ino}] = off;
+            off += len;
+        }
+    }
+};
+
+SnapshotCache* snapshot_cache = nullptr;
+
+// --watch: 对扫描过的每个目录加 inotify 监视. 有变化时丢弃该目录的快照记录并重画;
+// 重画时没有变化的目录直接用快照, 只有变了的目录重新读取
+class DirWatcher {
+  public:
+    DirWatcher() : fd_(inotify_init1(IN_CLOEXEC)) {}
+    ~DirWatcher() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    void add(const fs::path& path, const DevIno& id) {
+        constexpr uint32_t mask =
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (fd_ < 0 || !watched_.insert(id).second) {
+            return;
+        }
+        int wd = inotify_add_watch(fd_, path.c_str(), mask);
+        if (wd >= 0) {
+            wds_[wd] = id;
+        } else {
+            watched_.erase(id);
+        }
+    }
+
+    // 阻塞到有变化, 再等 100ms 内不再有新事件 (合并一连串的修改); 监视不可用时返回 false
+    bool wait(SnapshotCache& cache) {
+        if (fd_ < 0) {
+            return false;
+        }
+        alignas(struct inotify_event) char buf[16384];
+        int timeout = -1;
+        while (true) {
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            int r = poll(&pfd, 1, timeout);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                return r == 0;
+            }
+            ssize_t n = read(fd_, buf, sizeof(buf));
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            for (ssize_t off = 0; off < n;) {
+                auto* ev = reinterpret_cast<struct inotify_event*>(buf + off);
+                off += sizeof(struct inotify_event) + ev->len;
+                auto it = wds_.find(ev->wd);
+                if (it == wds_.end()) {
+                    continue;
+                }
+                cache.invalidate(it->second);
+                if (ev->mask & IN_IGNORED) { // 目录已删除或移走, 下次扫描到时重新监视
+                    watched_.erase(it->second);
+                    wds_.erase(it);
+                }
+            }
+            timeout = 100;
+        }
+    }
+
+  private:
+    int fd_;
+    std::mutex mtx_;
+    std::unordered_map<int, DevIno> wds_;
+    std::unordered_set<DevIno, DevInoHash> watched_;
+};
+
+DirWatcher* dir_watcher = nullptr;
+
+// 快照命中后补上目录 mtime 反映不出的信息: 符号链接 (及 DT_UNKNOWN) 重新跟随 stat,
+// 颜色按 d_type 重新计算 (需要权限位时 lstat). 链接是否指向目录变了时排序也会变, 返回 false 由调用者重新扫描
+bool refresh_listing(const fs::path& path, const Config& config, Listing& listing) {
+    int fd = -1;
+    bool ok = true;
+    std::string name;
+    for (auto& e : listing.entries) {
+        bool follow = e.type == DT_LNK || e.type == DT_UNKNOWN;
+        if (!follow && !config.show_color) {
+            continue;
+        }
+        if (fd < 0 && (follow || ls_colors.needs_stat(e.type))) {
+            int atfd;
+            const char* rel = at_path(path.native(), atfd);
+            syscall_stats.open++;
+            fd = openat(atfd, rel, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0) {
+                return false;
+            }
+        }
+        name.assign(listing.name(e));
+        bool link_ok = false;
+        uint32_t target_mode = 0;
+        if (follow) {
+            struct stat st;
+            if (counted_fstatat(fd, name.c_str(), &st, 0) == 0) {
+                link_ok = true;
+                target_mode = st.st_mode;
+            } else if (errno != ENOENT && errno != ENOTDIR) {
+                ok = false;
+                break;
+            }
+            if ((link_ok && S_ISDIR(target_mode)) != e.is_dir()) {
+                ok = false;
+                break;
+            }
+        }
+        if (config.show_color) {
+            e.color = color_of(e.type, fd, name.c_str(), link_ok, target_mode);
+        }
+    }
+    if (fd >= 0) {
+        syscall_stats.close++;
+        close(fd);
+    }
+    return ok;
+}
+
+// 读取并排序目录, 结果放入 listing (原有内容清空). 每个目录项最多 stat 一次, 不在排序比较时反复 stat.
+// 有快照缓存时, 未变化的目录只需一次 fstatat, 再加上符号链接与上色需要的 stat
+void scan_dir(const fs::path& path, const Config& config, const IgnoreFrame* ignore, Listing& listing) {
+    DirKey key;
+    bool cached = snapshot_cache && snapshot_cache->lookup(path, listing, key) &&
+                  refresh_listing(path, config, listing);
+    if (dir_watcher && key.valid) {
+        dir_watcher->add(path, key.id);
+    }
+    if (cached) {
+        count_listing(listing);
+        return;
+    }
+    listing.clear();
+    if (!scan_dir_raw(path, config, ignore, listing)) {
+        syscall_stats.fallback++;
+        listing.clear();
+        scan_dir_fs(path, config, ignore, listing);
+    }
+    if (!listing.failed) {
+        finish_listing(path, listing, config);
+        if (snapshot_cache) {
+            snapshot_cache->store(key, listing);
+        }
+    }
+}
+
+// JSON 输出 -------------------------------------------------------------
+// 边遍历边写出, 字符串直接转义进输出缓冲区, 不产生临时对象, 内存占用与树的大小无关.
+// 名字中不是合法 UTF-8 的字节按 Latin-1 写成 \u00XX, 保证输出能被严格的 JSON 解析器读入
+
+// s[i] 起是一个合法 UTF-8 多字节序列时返回其长度, 否则返回 0 (拒绝超长编码, 代理区和超出 U+10FFFF 的码点)
+size_t utf8_seq(std::string_view s, size_t i) {
+    auto at = [&](size_t k) { return i + k < s.size() ? static_cast<unsigned char>(s[i + k]) : 0; };
+    unsigned char c = at(0);
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xbf; // 第二个字节的范围
+    if (c >= 0xc2 && c <= 0xdf) {
+        len = 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+        len = 3;
+        lo = c == 0xe0 ? 0xa0 : 0x80;
+        hi = c == 0xed ? 0x9f : 0xbf;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+        len = 4;
+        lo = c == 0xf0 ? 0x90 : 0x80;
+        hi = c == 0xf4 ? 0x8f : 0xbf;
+    } else {
+        return 0;
+    }
+    if (at(1) < lo || at(1) > hi) {
+        return 0;
+    }
+    for (size_t k = 2; k < len; ++k) {
+        if ((at(k) & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+// 写出转义后的字符串内容 (不含引号): 不需要转义的连续字节整段写出
+void put_json_chars(std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = s[i];
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            continue;
+        }
+        if (size_t n = c >= 0x80 ? utf8_seq(s, i) : 0) {
+            i += n - 1;
+            continue;
+        }
+        out.put(s.data() + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"': out.put("\\\""); break;
+        case '\\': out.put("\\\\"); break;
+        case '\n': out.put("\\n"); break;
+        case '\t': out.put("\\t"); break;
+        case '\r': out.put("\\r"); break;
+        default:
+            out.put("\\u00");
+            out.put(hex[c >> 4]);
+            out.put(hex[c & 15]);
+        }
+    }
+    out.put(s.data() + run, s.size() - run);
+}
+
+void put_json(std::string_view s) {
+    out.put('"');
+    put_json_chars(s);
+    out.put('"');
+}
+
+const char* type_name(uint32_t mode) {
+    switch (mode & S_IFMT) {
+    case S_IFDIR: return "directory";
+    case S_IFLNK: return "link";
+    case S_IFREG: return "file";
+    case S_IFIFO: return "fifo";
+    case S_IFSOCK: return "socket";
+    case S_IFCHR: return "char";
+    case S_IFBLK: return "block";
+    default: return "unknown";
+    }
+}
+
+// ,"type":...,"size":...,"mode":"0755"[,"target":...]
+void put_json_meta(const Listing& listing, size_t i) {
+    const Entry& e = listing.entries[i];
+    const Meta& m = listing.meta[i];
+    out.put(",\"type\":\"");
+    out.put(type_name(m.mode));
+    out.put("\",\"size\":");
+    out.put_num(m.size);
+    out.put(",\"mode\":\"");
+    for (int shift = 9; shift >= 0; shift -= 3) {
+        out.put(static_cast<char>('0' + ((m.mode >> shift) & 7)));
+    }
+    out.put('"');
+    if (e.is_link()) {
+        out.put(",\"target\":");
+        if (e.broken()) {
+            out.put("null");
+        } else {
+            put_json(listing.target(e));
+        }
+    }
+}
+
+// 目录与名字拼成的路径, 不构造 fs::path; sep 为 false 时目录已以 '/' 结尾 (与 child_path 一致)
+void put_json_path(std::string_view dir, bool sep, std::string_view name) {
+    out.put('"');
+    put_json_chars(dir);
+    if (sep) {
+        out.put('/');
+    }
+    put_json_chars(name);
+    out.put('"');
+}
+
+// 逐项输出 ---------------------------------------------------------------
+// 串行与并行遍历都用显式栈按深度优先顺序逐项调用这里的函数, 保证两者输出逐字节相同.
+// entry_open 输出一项; 要展开的目录 (expand) 在此之后输出其子树, 再调用 entry_close 收尾.
+// prefix 为当前层的前缀 (文本为连线, -J 为缩进), 由调用者在进入/离开子目录时追加/截断
+
+// 子目录相对当前层追加的前缀
+const char* child_indent(const Config& config, bool is_last) {
+    switch (config.format) {
+    case Config::TEXT: return is_last ? "    " : "│   ";
+    case Config::JSON: return "  ";
+    default: return "";
+    }
+}
+
+// dir 为 listing 所属目录的路径 (--ndjson 用)
+void entry_open(std::string_view dir, const Listing& listing, size_t i, const Config& config, int current_level,
+                const std::string& prefix, bool expand) {
+    const auto& entry = listing.entries[i];
+    bool is_last = (i == listing.entries.size() - 1);
+    if (config.format == Config::JSON) {
+        out.put(prefix);
+        out.put("{\"name\":");
+        put_json(listing.name(entry));
+        put_json_meta(listing, i);
+        if (entry.recursive()) {
+            out.put(",\"recursive\":true");
+        }
+        if (expand) {
+            out.put(",\"contents\":[");
+        } else {
+            out.put(is_last ? "}" : "},");
+        }
+        out.end_line();
+        return;
+    }
+    if (config.format == Config::NDJSON) {
+        out.put("{\"path\":");
+        put_json_path(dir, !dir.empty() && dir.back() != '/', listing.name(entry));
+        out.put(",\"depth\":");
+        out.put_num(current_level);
+        put_json_meta(listing, i);
+        if (entry.recursive()) {
+            out.put(",\"recursive\":true");
+        }
+        out.put('}');
+        out.end_line();
+        return;
+    }
+    if (current_level > 0) {
+        out.put(prefix);
+        out.put(is_last ? "└── " : "├── ");
+    }
+    if (config.show_color && entry.color != C_NONE) { // LS_COLORS 未给这类文件配色时原样输出
+        out.put(ls_colors.code(entry.color));
+        out.put(listing.name(entry));
+        out.put(ls_colors.reset());
+    } else {
+        out.put(listing.name(entry));
+    }
+    if (entry.is_dir()) {
+        out.put('/'); // 目录标记
+        if (entry.recursive()) {
+            out.put("  [recursive, not followed]");
+        }
+    } else if (entry.is_link()) {
+        out.put(" -> ");
+        if (entry.broken()) {
+            out.put("[broken]");
+        } else if (config.show_color && entry.target_color != C_NONE) {
+            out.put(ls_colors.code(entry.target_color));
+            out.put(listing.target(entry));
+            out.put(ls_colors.reset());
+        } else {
+            out.put(listing.target(entry));
+        }
+    }
+    out.end_line();
+}
+
+// 展开的目录输出完子树之后; prefix 为该目录项所在层的前缀
+void entry_close(const Listing& listing, size_t i, const Config& config, const std::string& prefix) {
+    if (config.format == Config::JSON) {
+        out.put(prefix);
+        out.put(i + 1 < listing.entries.size() ? "]}," : "]}");
+        out.end_line();
+    }
+}
+
+// 目录读取失败; prefix 为该目录内容所在层的前缀
+void print_error(std::string_view dir, const Listing& listing, const Config& config, int current_level,
+                 const std::string& prefix) {
+    if (config.format == Config::JSON) {
+        out.put(prefix);
+        out.put("{\"type\":\"error\",\"message\":");
+        put_json(listing.error);
+        out.put('}');
+        out.end_line();
+    } else if (config.format == Config::NDJSON) {
+        out.put("{\"path\":");
+        put_json(dir);
+        out.put(",\"type\":\"error\",\"depth\":");
+        out.put_num(current_level - 1);
+        out.put(",\"error\":");
+        put_json(listing.error);
+        out.put('}');
+        out.end_line();
+    } else if (config.show_error) {
+        out.flush(); // 保持与标准输出的先后顺序
+        std::cerr << COLOR_RESET << prefix << "└── [Error: " << listing.error << "]" << std::endl;
+    }
+}
+
+// 与 child_path 相同的拼接规则, 直接追加到路径缓冲区
+void push_name(std::string& path, std::string_view name) {
+    if (!path.empty() && path.back() != '/') {
+        path += '/';
+    }
+    path.append(name);
+}
+
+bool stat_id(const std::string& path, DevIno& id) {
+    struct stat st;
+    int atfd;
+    const char* rel = at_path(path, atfd);
+    if (counted_fstatat(atfd, rel, &st, 0) != 0) {
+        return false;
+    }
+    id = {st.st_dev, st.st_ino};
+    return true;
+}
+
+// 串行遍历: 显式栈代替递归, 目录再深也不会栈溢出. 路径和前缀各用一个缓冲区,
+// 进入子目录时追加、离开时截断, 不为每个目录复制一份; 每层一个 Listing, 兄弟目录之间复用其容量.
+// -l 时记录当前路径上各目录的 (dev, ino), 指回其中之一的目录项标记为 recursive 且不展开
+void print_tree(const fs::path& root, const Config& config, const std::string& root_prefix) {
+    struct Frame {
+        int level;
+        size_t path_len, prefix_len; // 父目录的路径与前缀长度, 离开时恢复
+        size_t index;                // 在父目录中的下标
+        size_t next = 0;             // 下一个要输出的目录项
+        std::shared_ptr<const IgnoreFrame> ignore;
+        DevIno id{0, 0};
+        PathAnchor saved_anchor; // 本目录打开了新锚点时, 离开时恢复
+        bool anchored = false;
+    };
+    static std::deque<Listing> levels; // deque 扩展时不会移动已有元素
+    std::string path = root.native();
+    std::string prefix = root_prefix;
+    std::vector<Frame> stack;
+    std::unordered_set<DevIno, DevInoHash> on_path;
+
+    // 扫描 path 并压栈; 读不了时输出错误并返回 false
+    auto enter = [&](Frame f, std::shared_ptr<const IgnoreFrame> parent_ignore) {
+        while (levels.size() <= static_cast<size_t>(f.level)) {
+            levels.emplace_back();
+        }
+        Listing& listing = levels[f.level];
+        fs::path dir(path);
+        f.ignore = ignore_for(dir, config, std::move(parent_ignore));
+        scan_dir(dir, config, f.ignore.get(), listing);
+        if (listing.failed) {
+            print_error(path, listing, config, f.level, prefix);
+            return false;
+        }
+        int fd = open_anchor(path);
+        if (fd >= 0) {
+            f.saved_anchor = path_anchor;
+            f.anchored = true;
+            path_anchor = {fd, path.size()};
+        }
+        if (config.follow) {
+            on_path.insert(f.id);
+        }
+        stack.push_back(std::move(f));
+        return true;
+    };
+
+    Frame top;
+    top.level = 1;
+    if (config.follow) {
+        stat_id(path, top.id);
+    }
+    enter(std::move(top), nullptr);
+    while (!stack.empty()) {
+        Frame& f = stack.back();
+        Listing& listing = levels[f.level];
+        if (f.next == listing.entries.size()) {
+            Frame done = std::move(f);
+            stack.pop_back();
+            if (config.follow) {
+                on_path.erase(done.id);
+            }
+            if (done.anchored) {
+                close(path_anchor.fd);
+                path_anchor = done.saved_anchor;
+            }
+            if (!stack.empty()) {
+                path.resize(done.path_len);
+                prefix.resize(done.prefix_len);
+                entry_close(levels[stack.back().level], done.index, config, prefix);
+            }
+            continue;
+        }
+        size_t i = f.next++;
+        Entry& e = listing.entries[i];
+        bool expand = e.is_dir() && f.level < config.max_level;
+        size_t path_len = path.size();
+        push_name(path, listing.name(e));
+        Frame child;
+        if (expand && config.follow && stat_id(path, child.id) && on_path.count(child.id)) {
+            e.flags |= Entry::RECURSIVE;
+            expand = false;
+        }
+        entry_open(std::string_view(path.data(), path_len), listing, i, config, f.level, prefix, expand);
+        if (!expand) {
+            path.resize(path_len);
+            continue;
+        }
+        size_t prefix_len = prefix.size();
+        child.level = f.level + 1;
+        child.path_len = path_len;
+        child.prefix_len = prefix_len;
+        child.index = i;
+        prefix += child_indent(config, i + 1 == listing.entries.size());
+        if (!enter(std::move(child), f.ignore)) { // 压栈会使 f 失效, 只有失败时才继续使用 listing
+            path.resize(path_len);
+            prefix.resize(prefix_len);
+            entry_close(listing, i, config, prefix);
         }
-        // 排序：目录在前，文件在后，按字母序
-        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
-            bool a_is_dir = fs::is_directory(a.status());
-            bool b_is_dir = fs::is_directory(b.status());
-            if (a_is_dir != b_is_dir) {
-                return a_is_dir;
+    }
+}
+
+// 磁盘占用 (--du) -------------------------------------------------------
+// 每个目录的大小要等整个子树统计完才知道, 兄弟项又要按大小排序, 所以先自底向上汇总再输出.
+// 汇总时只为 -L 范围内要显示的目录项建节点, 更深的子树扫描完即丢弃, 只把合计加到上层;
+// 扫描仍按层复用 Listing. 每项只做一次 statx (不跟随链接, 只取类型/inode/大小/块数),
+// nlink > 1 的文件按 (dev, ino) 去重, 同一个文件只计一次. 符号链接不展开.
+struct DuNode {
+    std::string name;
+    uint64_t size = 0;   // 表观大小合计
+    uint64_t blocks = 0; // 占用的 512 字节块合计
+    bool is_dir = false;
+    uint8_t color = C_NONE;
+    bool failed = false;
+    std::string error;
+    std::vector<DuNode> children;
+};
+
+std::unordered_set<DevIno, DevInoHash> seen_links;
+bool du_incomplete = false; // 有目录读不了, 合计不完整
+
+// 读取目录, meta 中记录本项应计入的大小 (重复的硬链接为 0). 目录打不开时 listing.failed.
+// --io-uring 时每个目录块的 statx 一起提交, 再按原顺序处理 (硬链接去重的结果与逐项时相同)
+void scan_du(const fs::path& path, const Config& config, const IgnoreFrame* ignore, Listing& listing) {
+    constexpr unsigned mask = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_BLOCKS;
+    listing.clear();
+    auto take = [&](const char* name, unsigned char type, bool ok, const struct statx& stx) {
+        Meta m{0, 0, static_cast<uint32_t>(DTTOIF(type))};
+        if (ok) {
+            m.mode = stx.stx_mode;
+        }
+        if (!keep(config, ignore, path, name, S_ISDIR(m.mode))) {
+            return;
+        }
+        if (ok) {
+            bool dup = false;
+            if (!S_ISDIR(stx.stx_mode) && stx.stx_nlink > 1) {
+                DevIno key{makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino};
+                dup = !seen_links.insert(key).second;
+            }
+            if (!dup) {
+                m.size = stx.stx_size;
+                m.blocks = stx.stx_blocks;
             }
-            return a.path().filename() < b.path().filename();
+        }
+        listing.add(name, S_ISDIR(m.mode) ? Entry::DIR : 0, C_NONE);
+        listing.meta.push_back(m);
+    };
+    int atfd;
+    const char* rel = at_path(path.native(), atfd);
+    bool ok;
+    if (StatxBatch* ring = statx_batch(config)) {
+        pending_stats.clear();
+        auto collect = [&](const char* name, unsigned char type, int) {
+            pending_stats.push_back(PendingStat{name, type, false, false, 0, 0, {}, {}});
+            return true;
+        };
+        auto flush = [&](int dirfd) {
+            for (auto& p : pending_stats) {
+                syscall_stats.uring_statx++;
+                ring->add(dirfd, p.name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, mask, &p.lstat, &p.lstat_res);
+            }
+            ring->run();
+            for (const auto& p : pending_stats) {
+                take(p.name, p.type, p.lstat_res == 0, p.lstat);
+            }
+            pending_stats.clear();
+            return true;
+        };
+        ok = read_dir(atfd, rel, collect, flush);
+    } else {
+        ok = read_dir(atfd, rel, [&](const char* name, unsigned char type, int dirfd) {
+            struct statx stx;
+            take(name, type, counted_statx(dirfd, name, mask, &stx) == 0, stx);
+            return true;
         });
+    }
+    if (!ok) {
+        std::error_code ec(errno, std::generic_category());
+        listing.clear();
+        listing.error = fs::filesystem_error("directory iterator cannot open directory", path, ec).what();
+        listing.failed = true;
+    }
+}
+
+// 汇总 root 下所有目录项 (不含 root 自身) 的大小, 为 -L 范围内的目录项建节点并按大小排序.
+// 与 print_tree 一样用显式栈代替递归, 共用一个路径缓冲区, 路径过长时打开锚点.
+// 有目录读不了时 du_incomplete 置位: 上层的合计因此偏小, 退出状态非 0
+DuNode du_walk(const fs::path& root, const Config& config) {
+    struct Frame {
+        int level;
+        size_t path_len;  // 父目录的路径长度, 离开时恢复
+        size_t next = 0;  // 下一个要统计的目录项
+        bool show;        // 为本层目录项建节点
+        DuNode node;      // 本目录: 合计以及要显示的子节点
+        std::shared_ptr<const IgnoreFrame> ignore;
+        PathAnchor saved_anchor;
+        bool anchored = false;
+    };
+    static std::deque<Listing> levels;
+    std::string path = root.native();
+    std::vector<Frame> stack;
+    DuNode top;
+
+    // 把统计完的 n 计入所在目录 f
+    auto add = [&](Frame& f, DuNode&& n) {
+        f.node.size += n.size;
+        f.node.blocks += n.blocks;
+        if (f.show) {
+            (n.is_dir ? stats.dirs : stats.files)++;
+            f.node.children.push_back(std::move(n));
+        }
+    };
+    // 扫描 path 并压栈; 读不了时在 f.node 上记下错误并返回 false
+    auto enter = [&](Frame f, std::shared_ptr<const IgnoreFrame> parent_ignore) {
+        while (levels.size() <= static_cast<size_t>(f.level)) {
+            levels.emplace_back();
+        }
+        Listing& listing = levels[f.level];
+        f.ignore = ignore_for(fs::path(path), config, std::move(parent_ignore));
+        scan_du(path, config, f.ignore.get(), listing);
+        if (listing.failed) {
+            du_incomplete = true;
+            f.node.failed = true;
+            f.node.error = listing.error;
+            return std::move(f.node);
+        }
+        int fd = open_anchor(path);
+        if (fd >= 0) {
+            f.saved_anchor = path_anchor;
+            f.anchored = true;
+            path_anchor = {fd, path.size()};
+        }
+        stack.push_back(std::move(f));
+        return DuNode{};
+    };
+    auto by_size = [](const DuNode& a, const DuNode& b) {
+        if (a.size != b.size) {
+            return a.size > b.size;
+        }
+        return a.name < b.name;
+    };
 
-        size_t count = entries.size();
-        for (size_t i = 0; i < count; ++i) {
-            const auto& entry = entries[i];
-            std::string name = entry.path().filename().string();
-            bool is_last = (i == count - 1);
-            if (current_level > 0) {
-                std::cout << prefix;
-                std::cout << (is_last ? "└── " : "├── ");
-            }
-            if (config.show_color) {
-                std::string color = get_color(entry.path());
-                std::cout << color << name << COLOR_RESET;
+    Frame first;
+    first.level = 1;
+    first.path_len = path.size();
+    first.show = true;
+    top = enter(std::move(first), nullptr);
+    while (!stack.empty()) {
+        Frame& f = stack.back();
+        const Listing& listing = levels[f.level];
+        if (f.next == listing.entries.size()) {
+            Frame done = std::move(f);
+            stack.pop_back();
+            if (done.anchored) {
+                close(path_anchor.fd);
+                path_anchor = done.saved_anchor;
+            }
+            if (done.show) {
+                std::sort(done.node.children.begin(), done.node.children.end(), by_size);
+            }
+            path.resize(done.path_len);
+            if (stack.empty()) {
+                top = std::move(done.node);
             } else {
-                std::cout << name;
-            }
-            if (fs::is_directory(entry.status())) {
-                std::cout << "/"; // 目录标记
-                stats.dirs++;
-                std::cout << std::endl;
-                if (current_level < config.max_level) {
-                    std::string new_prefix = prefix + (is_last ? "    " : "│   ");
-                    print_tree(entry, config, current_level + 1, new_prefix);
+                add(stack.back(), std::move(done.node));
+            }
+            continue;
+        }
+        size_t i = f.next++;
+        const Entry& e = listing.entries[i];
+        const Meta& m = listing.meta[i];
+        DuNode node;
+        node.size = m.size;
+        node.blocks = m.blocks;
+        node.is_dir = e.is_dir();
+        if (f.show) {
+            node.name = listing.name(e);
+            // 只有 lstat 的信息: 链接不按目标上色, 不区分硬链接数
+            node.color = config.show_color ? ls_colors.color(node.name, DT_UNKNOWN, true, m.mode, 1, true, 0) : C_NONE;
+        }
+        if (!e.is_dir()) {
+            add(f, std::move(node));
+            continue;
+        }
+        size_t path_len = path.size();
+        Frame child;
+        child.level = f.level + 1;
+        child.path_len = path_len;
+        child.show = f.show && f.level < config.max_level;
+        child.node = std::move(node);
+        push_name(path, listing.name(e));
+        DuNode failed = enter(std::move(child), f.ignore); // 压栈会使 f 失效, 只有失败时才继续使用
+        if (failed.failed) {
+            path.resize(path_len);
+            add(f, std::move(failed));
+        }
+    }
+    return top;
+}
+
+// 大小字段: 默认为字节数, -h 时为 1024 进制的 K/M/G/T/P, 小于 10 时保留一位小数
+void put_size(uint64_t v, bool human) {
+    char buf[32];
+    int n;
+    if (!human) {
+        n = std::snprintf(buf, sizeof(buf), "%11llu", static_cast<unsigned long long>(v));
+    } else if (v < 1024) {
+        n = std::snprintf(buf, sizeof(buf), "%5llu", static_cast<unsigned long long>(v));
+    } else {
+        const char* units = "KMGTPE";
+        double d = v / 1024.0;
+        int u = 0;
+        while (d >= 1024 && u < 5) {
+            d /= 1024;
+            u++;
+        }
+        n = std::snprintf(buf, sizeof(buf), d < 10 ? "%4.1f%c" : "%4.0f%c", d, units[u]);
+    }
+    out.put(buf, n);
+}
+
+// [表观大小 占用空间]  (占用空间 = 块数 * 512)
+void put_du_sizes(const DuNode& node, const Config& config) {
+    out.put('[');
+    put_size(node.size, config.human);
+    out.put(' ');
+    put_size(node.blocks * 512, config.human);
+    out.put("]  ");
+}
+
+void print_du(const DuNode& dir, const Config& config, const std::string& prefix) {
+    if (dir.failed) {
+        if (config.show_error) {
+            out.flush();
+            std::cerr << COLOR_RESET << prefix << "└── [Error: " << dir.error << "]" << std::endl;
+        }
+        return;
+    }
+    size_t count = dir.children.size();
+    for (size_t i = 0; i < count; ++i) {
+        const DuNode& node = dir.children[i];
+        bool is_last = (i == count - 1);
+        out.put(prefix);
+        out.put(is_last ? "└── " : "├── ");
+        put_du_sizes(node, config);
+        if (config.show_color && node.color != C_NONE) {
+            out.put(ls_colors.code(node.color));
+            out.put(node.name);
+            out.put(ls_colors.reset());
+        } else {
+            out.put(node.name);
+        }
+        if (node.is_dir) {
+            out.put('/');
+        }
+        out.end_line();
+        if (node.is_dir) {
+            print_du(node, config, prefix + (is_last ? "    " : "│   "));
+        }
+    }
+}
+
+// 并行遍历 (-j N) -------------------------------------------------------
+// 每个待扫描的目录是一个 DirNode. 扫描完一个目录后, 为其中需要展开的子目录各建一个节点,
+// 压进当前线程自己的双端队列尾部; 线程优先从自己队列尾部取 (深度优先, 局部性好),
+// 自己的队列空了再从其它线程队列的头部偷 (偷到的是较浅、较大的子树).
+// 输出由主线程按深度优先顺序完成: 轮到某个节点时若已扫描完就直接输出, 还在队列里就自己扫描,
+// 正被其它线程扫描时等待. 输出顺序只取决于树的结构, 因此与串行模式逐字节相同.
+// 节点只存自己的名字, 扫描时沿 parent 向上拼出路径; 走到锚点目录为止, 所以拼接的长度不超过 ANCHOR_SPAN 左右.
+struct DirNode;
+
+// 并行遍历中由子目录共享的锚点, 最后一个使用者释放时关闭. 同时记下锚点目录本身和它的完整路径
+struct SharedAnchor {
+    int fd;
+    std::string path;
+    const DirNode* dir; // 使用锚点的都是它的后代, 扫描它们时它一定还在
+    SharedAnchor(int f, std::string p, const DirNode* d) : fd(f), path(std::move(p)), dir(d) {}
+    ~SharedAnchor() { close(fd); }
+    SharedAnchor(const SharedAnchor&) = delete;
+    SharedAnchor& operator=(const SharedAnchor&) = delete;
+};
+
+struct DirNode {
+    enum { QUEUED, SCANNING, READY };
+    std::string name; // 起始目录为完整路径, 其余为目录项名字
+    int level;
+    std::atomic<int> state{QUEUED};
+    Listing listing;
+    std::vector<std::shared_ptr<DirNode>> children; // 与需要展开的目录项一一对应
+    std::shared_ptr<const IgnoreFrame> ignore;      // 上层目录的 .gitignore 规则, 扫描后换成本目录的
+    const DirNode* parent; // 在本节点输出完之前一直有效 (拼路径和 -l 检测环路用)
+    DevIno id{0, 0};
+    std::shared_ptr<const SharedAnchor> anchor; // 很深的目录相对它访问
+
+    DirNode(std::string n, int l, std::shared_ptr<const IgnoreFrame> ign = nullptr, const DirNode* par = nullptr,
+            std::shared_ptr<const SharedAnchor> anc = nullptr)
+        : name(std::move(n)), level(l), ignore(std::move(ign)), parent(par), anchor(std::move(anc)) {}
+};
+
+// 把 node 的完整路径拼进 path: 从锚点目录 (没有锚点时从起始目录) 的路径开始, 依次追加下面各层的名字
+void node_path(const DirNode& node, std::string& path) {
+    thread_local std::vector<const DirNode*> chain;
+    const DirNode* top = node.anchor ? node.anchor->dir : nullptr;
+    chain.clear();
+    const DirNode* n = &node;
+    for (; n != top && n->parent; n = n->parent) {
+        chain.push_back(n);
+    }
+    path = n == top ? node.anchor->path : n->name;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        push_name(path, (*it)->name);
+    }
+}
+
+class ParallelWalker {
+  public:
+    ParallelWalker(const Config& config, int nthreads) : config_(config), deques_(nthreads) {
+        for (int i = 0; i < nthreads; ++i) {
+            threads_.emplace_back([this, i] { worker(i); });
+        }
+    }
+
+    ~ParallelWalker() {
+        {
+            std::lock_guard<std::mutex> lk(work_mtx_);
+            stop_ = true;
+        }
+        work_cv_.notify_all();
+        for (auto& t : threads_) {
+            t.join();
+        }
+    }
+
+    void print(const fs::path& path, int level, const std::string& prefix) {
+        print_nodes(std::make_shared<DirNode>(path.native(), level), prefix);
+    }
+
+  private:
+    struct WorkDeque {
+        std::mutex mtx;
+        std::deque<std::shared_ptr<DirNode>> q;
+    };
+
+    const Config& config_;
+    std::vector<WorkDeque> deques_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> queued_{0};
+    std::mutex work_mtx_;
+    std::condition_variable work_cv_;
+    bool stop_ = false;
+    std::mutex done_mtx_;
+    std::condition_variable done_cv_;
+
+    static bool claim(DirNode& node) {
+        int expected = DirNode::QUEUED;
+        return node.state.compare_exchange_strong(expected, DirNode::SCANNING);
+    }
+
+    // 扫描目录并把子目录加入队列 owner (主线程用 0 号队列)
+    void scan(DirNode& node, size_t owner) {
+        thread_local std::string path; // 每个线程一个路径缓冲区
+        node_path(node, path);
+        if (node.anchor) {
+            path_anchor = {node.anchor->fd, node.anchor->path.size()};
+        }
+        fs::path dir(path);
+        node.ignore = ignore_for(dir, config_, std::move(node.ignore));
+        scan_dir(dir, config_, node.ignore.get(), node.listing);
+        if (config_.follow) {
+            stat_id(path, node.id);
+        }
+        if (node.level < config_.max_level) {
+            auto anchor = node.anchor;
+            int fd = open_anchor(path);
+            if (fd >= 0) {
+                anchor = std::make_shared<SharedAnchor>(fd, path, &node);
+            }
+            size_t path_len = path.size();
+            for (auto& e : node.listing.entries) {
+                if (!e.is_dir()) {
+                    continue;
                 }
-            } else if (fs::is_symlink(entry.status())) {
-                std::cout << " -> ";
-                try {
-                    auto target = fs::read_symlink(entry.path());
-                    if (config.show_color) {
-                        std::string color = get_color(target);
-                        std::cout << color << target.string() << COLOR_RESET;
-                    } else {
-                        std::cout << target.string();
+                std::string_view name = node.listing.name(e);
+                DevIno id;
+                if (config_.follow) {
+                    push_name(path, name);
+                    bool loop = stat_id(path, id) && on_path(node, id);
+                    path.resize(path_len);
+                    if (loop) {
+                        e.flags |= Entry::RECURSIVE;
+                        continue;
                     }
-                } catch (const fs::filesystem_error&) {
-                    std::cout << "[broken]";
                 }
-                stats.files++;
-                std::cout << std::endl;
+                node.children.push_back(
+                    std::make_shared<DirNode>(std::string(name), node.level + 1, node.ignore, &node, anchor));
+            }
+            // 逆序压入, 使 pop_back 先取到排在前面 (最先输出) 的子目录
+            if (!node.children.empty()) {
+                WorkDeque& d = deques_[owner];
+                {
+                    std::lock_guard<std::mutex> lk(d.mtx);
+                    for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+                        d.q.push_back(*it);
+                    }
+                }
+                queued_ += node.children.size();
+                {
+                    std::lock_guard<std::mutex> lk(work_mtx_);
+                }
+                work_cv_.notify_all();
+            }
+        }
+        path_anchor = PathAnchor();
+        {
+            std::lock_guard<std::mutex> lk(done_mtx_);
+            node.state = DirNode::READY;
+        }
+        done_cv_.notify_one();
+    }
+
+    // 先取自己队列的尾部, 再从其它队列头部偷
+    std::shared_ptr<DirNode> take(size_t self) {
+        size_t n = deques_.size();
+        for (size_t k = 0; k < n; ++k) {
+            WorkDeque& d = deques_[(self + k) % n];
+            std::lock_guard<std::mutex> lk(d.mtx);
+            if (d.q.empty()) {
+                continue;
+            }
+            std::shared_ptr<DirNode> node;
+            if (k == 0) {
+                node = std::move(d.q.back());
+                d.q.pop_back();
             } else {
-                stats.files++;
-                std::cout << std::endl;
+                node = std::move(d.q.front());
+                d.q.pop_front();
             }
+            queued_--;
+            return node;
         }
-    } catch (const fs::filesystem_error& e) {
-        if (config.show_error) {
-            std::cerr << COLOR_RESET << prefix << "└── [Error: " << e.what() << "]" << std::endl;
+        return nullptr;
+    }
+
+    void worker(size_t self) {
+        while (true) {
+            auto node = take(self);
+            if (node) {
+                if (claim(*node)) { // 主线程可能已经自己扫描了它
+                    scan(*node, self);
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(work_mtx_);
+            work_cv_.wait(lk, [this] { return stop_ || queued_ > 0; });
+            if (stop_) {
+                return;
+            }
+        }
+    }
+
+    // node 或其祖先是否就是 id
+    static bool on_path(const DirNode& node, const DevIno& id) {
+        for (const DirNode* n = &node; n; n = n->parent) {
+            if (n->id == id) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 轮到 node 输出时: 还在队列里就自己扫描, 正被其它线程扫描就等待
+    void wait_ready(DirNode& node) {
+        if (claim(node)) {
+            scan(node, 0);
+        } else if (node.state != DirNode::READY) {
+            std::unique_lock<std::mutex> lk(done_mtx_);
+            done_cv_.wait(lk, [&node] { return node.state == DirNode::READY; });
         }
     }
+
+    // 与串行模式相同的显式栈, 按深度优先顺序输出; 节点出栈时即释放其扫描结果
+    void print_nodes(std::shared_ptr<DirNode> root, std::string prefix) {
+        struct Frame {
+            std::shared_ptr<DirNode> node;
+            size_t path_len, prefix_len, index; // 父目录的路径与前缀长度和本目录在父目录中的下标
+            size_t next = 0, child = 0;
+        };
+        std::vector<Frame> stack;
+        std::string path = root->name;
+        auto enter = [&](Frame f) {
+            DirNode& node = *f.node;
+            wait_ready(node);
+            if (node.listing.failed) {
+                print_error(path, node.listing, config_, node.level, prefix);
+                return false;
+            }
+            stack.push_back(std::move(f));
+            return true;
+        };
+        enter(Frame{std::move(root), 0, 0, 0});
+        while (!stack.empty()) {
+            Frame& f = stack.back();
+            DirNode& node = *f.node;
+            const Listing& listing = node.listing;
+            if (f.next == listing.entries.size()) {
+                size_t path_len = f.path_len, prefix_len = f.prefix_len, index = f.index;
+                stack.pop_back();
+                if (!stack.empty()) {
+                    path.resize(path_len);
+                    prefix.resize(prefix_len);
+                    entry_close(stack.back().node->listing, index, config_, prefix);
+                }
+                continue;
+            }
+            size_t i = f.next++;
+            const Entry& e = listing.entries[i];
+            bool expand = e.is_dir() && !e.recursive() && node.level < config_.max_level;
+            entry_open(path, listing, i, config_, node.level, prefix, expand);
+            if (!expand) {
+                continue;
+            }
+            size_t path_len = path.size(), prefix_len = prefix.size();
+            push_name(path, listing.name(e));
+            prefix += child_indent(config_, i + 1 == listing.entries.size());
+            if (!enter(Frame{std::move(node.children[f.child++]), path_len, prefix_len, i})) {
+                path.resize(path_len);
+                prefix.resize(prefix_len);
+                entry_close(listing, i, config_, prefix);
+            }
+        }
+    }
+};
+
+// 输出一次整棵树 (含结尾的统计行)
+void render(const fs::path& path, const Config& config) {
+    stats.dirs = fs::is_directory(path) ? 1 : 0;
+    stats.files = 0;
+    std::string prefix;
+    if (config.format == Config::TEXT && !config.du) { // --du 的根目录行要等整棵树汇总完才能输出
+        out.put('.');
+        out.end_line();
+    } else if (config.format == Config::JSON) {
+        out.put('[');
+        out.end_line();
+        out.put("  {\"name\":");
+        put_json(path.native());
+        out.put(",\"type\":\"directory\",\"contents\":[");
+        out.end_line();
+        prefix = "    ";
+    }
+    if (config.du) {
+        DuNode root = du_walk(path, config);
+        struct statx stx; // 加上根目录自身的大小
+        if (counted_statx(AT_FDCWD, path.c_str(), STATX_SIZE | STATX_BLOCKS, &stx) == 0) {
+            root.size += stx.stx_size;
+            root.blocks += stx.stx_blocks;
+        }
+        put_du_sizes(root, config);
+        out.put('.');
+        out.end_line();
+        print_du(root, config, "");
+    } else if (config.jobs > 0) {
+        ParallelWalker walker(config, config.jobs);
+        walker.print(path, 1, prefix);
+    } else {
+        print_tree(path, config, prefix);
+    }
+
+    size_t dirs = stats.dirs, files = stats.files;
+    if (config.format == Config::TEXT) {
+        out.put('\n');
+        out.put_num(dirs);
+        out.put((dirs == 1) ? " directory, " : " directories, ");
+        out.put_num(files);
+        out.put((files == 1) ? " file" : " files");
+        out.end_line();
+    } else if (config.format == Config::JSON) {
+        out.put("  ]},");
+        out.end_line();
+        out.put("  {\"type\":\"report\",\"directories\":");
+        out.put_num(dirs);
+        out.put(",\"files\":");
+        out.put_num(files);
+        out.put('}');
+        out.end_line();
+        out.put(']');
+        out.end_line();
+    }
+    out.flush();
+}
+
+// 影响 Listing 内容的选项: -C 决定是否存颜色, -P/-I 决定哪些目录项被列出
+uint64_t fingerprint(const Config& config, int argc, char* argv[]) {
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    auto mix = [&h](std::string_view s) {
+        for (unsigned char c : s) {
+            h = (h ^ c) * 1099511628211ULL;
+        }
+        h = (h ^ 0xff) * 1099511628211ULL;
+    };
+    mix(config.show_color ? "C" : "");
+    if (config.show_color) { // 快照中存的是颜色表下标, 配色变了就不能沿用
+        const char* spec = getenv("LS_COLORS");
+        mix(spec ? spec : "");
+    }
+    for (int i = 1; i + 1 < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "-P" || arg == "-I") {
+            mix(arg);
+            mix(argv[++i]);
+        }
+    }
+    return h;
 }
 
 int main(int argc, char* argv[]) {
@@ -127,6 +1810,8 @@ int main(int argc, char* argv[]) {
 
     Config config;
     fs::path path = ".";
+    std::string cache_dir;
+    bool watch = false;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -134,20 +1819,87 @@ int main(int argc, char* argv[]) {
             config.max_level = std::max(1, std::stoi(argv[++i]));
         } else if (arg == "-C") {
             config.show_color = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            config.jobs = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--stats") {
+            config.show_stats = true;
+        } else if (arg == "-J") {
+            config.format = Config::JSON;
+        } else if (arg == "--ndjson") {
+            config.format = Config::NDJSON;
+        } else if (arg == "--du") {
+            config.du = true;
+        } else if (arg == "-h") {
+            config.human = true;
+        } else if (arg == "-P" && i + 1 < argc) {
+            config.include.add(argv[++i]);
+        } else if (arg == "-I" && i + 1 < argc) {
+            config.exclude.add(argv[++i]);
+        } else if (arg == "--io-uring") {
+            config.io_uring = true;
+        } else if (arg == "-l") {
+            config.follow = true;
+        } else if (arg == "--gitignore") {
+            config.gitignore = true;
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (arg == "--watch") {
+            watch = true;
         } else {
             path = arg;
         }
     }
-
-    if (fs::is_directory(path)) {
-        stats.dirs++;
+    if (config.du) {
+        config.format = Config::TEXT;
+    }
+    if (config.format != Config::TEXT) {
+        config.show_color = false;
+    }
+    if (config.show_color) {
+        ls_colors.load(getenv("LS_COLORS"));
     }
-    std::cout << "." << std::endl;
-    print_tree(path, config, 1);
 
-    std::string dir_label = (stats.dirs == 1) ? "directory" : "directories";
-    std::string file_label = (stats.files == 1) ? "file" : "files";
-    std::cout << "\n" << stats.dirs << " " << dir_label << ", " << stats.files << " " << file_label << std::endl;
+    bool cache_ok = config.format == Config::TEXT && !config.du && !config.gitignore;
+    if ((!cache_dir.empty() || watch) && !cache_ok) {
+        std::cerr << "tree: --cache/--watch only apply to plain text output without --du/--gitignore" << std::endl;
+    } else if (!cache_dir.empty() || watch) {
+        // 快照文件以起始目录的 (dev, ino) 命名, 不同起始目录互不干扰
+        std::string file;
+        struct stat st;
+        if (!cache_dir.empty() && stat(path.c_str(), &st) == 0) {
+            file = cache_dir + "/tree-" + std::to_string(st.st_dev) + "-" + std::to_string(st.st_ino) + ".snap";
+        }
+        snapshot_cache = new SnapshotCache(file, fingerprint(config, argc, argv));
+        if (watch) {
+            dir_watcher = new DirWatcher();
+        }
+    }
 
+    render(path, config);
+    if (snapshot_cache) {
+        snapshot_cache->save();
+    }
+    while (dir_watcher && dir_watcher->wait(*snapshot_cache)) {
+        if (isatty(STDOUT_FILENO)) {
+            out.put("\033[H\033[2J");
+        }
+        snapshot_cache->begin_scan();
+        render(path, config);
+        snapshot_cache->save();
+    }
+    if (config.show_stats) {
+        std::cerr << "syscalls: " << syscall_stats.open << " open, " << syscall_stats.getdents << " getdents64, "
+                  << syscall_stats.fstatat << " fstatat, " << syscall_stats.statx << " statx, " << syscall_stats.close << " close ("
+                  << syscall_stats.fallback << " dirs via std::filesystem)";
+        if (config.io_uring) {
+            std::cerr << ", " << syscall_stats.uring_enter << " io_uring_enter (" << syscall_stats.uring_statx
+                      << " statx queued)";
+        }
+        std::cerr << std::endl;
+    }
+    if (du_incomplete) {
+        std::cerr << "tree: some directories could not be read, sizes are incomplete" << std::endl;
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#include "getdents.h"
+
+// --io-uring: 一个目录块 (一次 getdents64 取回的目录项) 需要的 statx 通过 io_uring 一起提交,
+// 所有请求同时在途, 一次 io_uring_enter 等待全部完成; 冷缓存或网络文件系统上
+// 不再按目录项逐个等待 I/O. 直接使用系统调用, 不依赖 liburing.
+// 内核不支持 io_uring 或 IORING_OP_STATX (或被 seccomp / io_uring_disabled 禁止) 时 ok() 为 false,
+// 调用者改用同步的 fstatat/statx.
+class StatxBatch {
+  public:
+    explicit StatxBatch(unsigned entries = 256) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd_ = syscall(SYS_io_uring_setup, entries, &p);
+        if (fd_ >= 0 && (!supports_statx() || !map_rings(p))) {
+            shutdown();
+        }
+    }
+
+    ~StatxBatch() { shutdown(); }
+
+    StatxBatch(const StatxBatch&) = delete;
+    StatxBatch& operator=(const StatxBatch&) = delete;
+
+    bool ok() const { return fd_ >= 0; }
+
+    // 排入一个请求, 完成时 *res 为 0 或 -errno. name, stx, res 在 run() 返回前必须保持有效;
+    // 提交队列满时先提交并等待已排入的请求
+    void add(int dirfd, const char* name, int flags, unsigned mask, struct statx* stx, int* res) {
+        if (queued_ == sq_entries_) {
+            run();
+            if (!ok()) {
+                *res = -EIO;
+                return;
+            }
+        }
+        unsigned idx = (*sq_tail_ + queued_) & sq_mask_;
+        io_uring_sqe& sqe = sqes_[idx];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_STATX;
+        sqe.fd = dirfd;
+        sqe.addr = reinterpret_cast<uint64_t>(name);
+        sqe.len = mask;
+        sqe.off = reinterpret_cast<uint64_t>(stx);
+        sqe.statx_flags = flags;
+        sqe.user_data = reinterpret_cast<uint64_t>(res);
+        sq_array_[idx] = idx;
+        *res = PENDING;
+        batch_.push_back(res);
+        queued_++;
+    }
+
+    // 提交所有排入的请求并等待其全部完成. io_uring_enter 出现无法重试的错误时
+    // 未完成请求的 *res 为 -errno, 之后 ok() 为 false
+    void run() {
+        if (queued_ == 0) {
+            return;
+        }
+        __atomic_store_n(sq_tail_, *sq_tail_ + queued_, __ATOMIC_RELEASE);
+        unsigned to_submit = queued_;
+        unsigned pending = queued_;
+        queued_ = 0;
+        while (pending > 0) {
+            syscall_stats.uring_enter++;
+            long n = syscall(SYS_io_uring_enter, fd_, to_submit, pending, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (n >= 0) {
+                to_submit -= std::min<unsigned long>(to_submit, n);
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                int err = -errno;
+                reap();
+                for (int* res : batch_) {
+                    if (*res == PENDING) {
+                        *res = err;
+                    }
+                }
+                shutdown();
+                break;
+            }
+            pending -= reap();
+        }
+        batch_.clear();
+    }
+
+  private:
+    static constexpr int PENDING = INT_MIN;
+
+    int fd_ = -1;
+    void* sq_ring_ = MAP_FAILED;
+    void* cq_ring_ = MAP_FAILED;
+    void* sqes_map_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0, cq_ring_size_ = 0, sqes_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0, sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+    unsigned queued_ = 0;       // 已填好但尚未提交的请求
+    std::vector<int*> batch_;   // 本批请求的结果位置
+
+    bool supports_statx() {
+        constexpr unsigned nops = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) + nops * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+        if (syscall(SYS_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, nops) < 0) {
+            return false;
+        }
+        return probe->last_op >= IORING_OP_STATX && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    bool map_rings(const io_uring_params& p) {
+        sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                        IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        cq_ring_ = single ? sq_ring_
+                          : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                                 IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_map_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_map_ == MAP_FAILED) {
+            return false;
+        }
+        char* sq = static_cast<char*>(sq_ring_);
+        char* cq = static_cast<char*>(cq_ring_);
+        sqes_ = static_cast<io_uring_sqe*>(sqes_map_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        return true;
+    }
+
+    // 取走已完成的请求, 返回个数
+    unsigned reap() {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned n = tail - head;
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            *reinterpret_cast<int*>(cqe.user_data) = cqe.res;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    void shutdown() {
+        if (sqes_map_ != MAP_FAILED) {
+            munmap(sqes_map_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        sqes_map_ = cq_ring_ = sq_ring_ = MAP_FAILED;
+        if (fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+        }
+    }
+};
@@ -2,6 +2,7 @@
 
 #include <fcntl.h>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <sys/wait.h>
@@ -12,25 +13,35 @@
 
 namespace fs = std::filesystem;
 
-// 原始终端配置保存
-static struct termios orig_termios;
+// 原始终端配置保存; 只在第一次进入原始模式时读取
+static struct termios orig_termios, raw_termios;
+static bool termios_saved = false, raw_active = false;
 
 char* getcwd(char* buf, size_t size) { return (syscall(SYS_getcwd, buf, size) >= 0) ? buf : nullptr; }
 
-// 启用原始模式
+// 启用原始模式. 用 TCSANOW 而不是 TCSAFLUSH: 命令执行期间预先键入的内容留在输入队列里, 不会被丢掉
 void enable_raw_mode() {
-    struct termios raw;
-    tcgetattr(STDIN_FILENO, &orig_termios);
-    raw = orig_termios;
-    raw.c_lflag &= ~ICANON;
-    // raw.c_lflag &= ~(ICANON | ECHO | ISIG); // 关闭规范模式、回显、信号处理
-    raw.c_cc[VMIN] = 1;  // 最小读取1字符
-    raw.c_cc[VTIME] = 0; // 无超时
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    if (raw_active)
+        return;
+    if (!termios_saved) {
+        if (tcgetattr(STDIN_FILENO, &orig_termios) != 0)
+            return;
+        raw_termios = orig_termios;
+        raw_termios.c_lflag &= ~ICANON;
+        // raw_termios.c_lflag &= ~(ICANON | ECHO | ISIG); // 关闭规范模式、回显、信号处理
+        raw_termios.c_cc[VMIN] = 1;  // 最小读取1字符
+        raw_termios.c_cc[VTIME] = 0; // 无超时
+        termios_saved = true;
+    }
+    raw_active = tcsetattr(STDIN_FILENO, TCSANOW, &raw_termios) == 0;
 }
 
-// 恢复终端原始设置
-void disable_raw_mode() { tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios); }
+// 恢复终端原始设置 (只在执行命令和退出时调用)
+void disable_raw_mode() {
+    if (raw_active)
+        tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
+    raw_active = false;
+}
 
 enum class TokenType {
     ARG,             // 默认
@@ -326,7 +337,8 @@ class Shell {
         while (!brk) {
             char ch;
             if (read(STDIN_FILENO, &ch, 1) <= 0) {
-                return;
+                disable_raw_mode();
+                exit(EXIT_SUCCESS);
             }
             switch (ch) {
             case 0x7F | '\b': // Backspace
@@ -459,12 +471,13 @@ class Shell {
             process_input();
             try {
                 auto cmd = parse_command(buf);
-                if (cmd)
+                if (cmd) {
+                    disable_raw_mode(); // 只在前台命令运行期间切回规范模式
                     cmd->execute();
+                }
             } catch (const std::exception& e) {
                 std::cerr << "Error: " << e.what() << '\n';
             }
-            disable_raw_mode();
         }
     }
 
@@ -0,0 +1,109 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include "mylib.h"
+#include "syscall.h"
+
+#include <elf.h>
+#include <time.h>
+
+// 时钟: 没有 libc 也就没有 clock_gettime, 每次取时间都走系统调用会干扰被测的东西.
+// 启动时从辅助向量 (envp 之后) 的 AT_SYSINFO_EHDR 找到内核映射进来的 vDSO,
+// 在它的动态符号表里解析 __vdso_clock_gettime, now_ns() 直接调用它; 找不到时退回系统调用.
+typedef int (*vdso_clock_fn)(clockid_t, struct timespec*);
+static vdso_clock_fn vdso_clock_gettime;
+
+// 动态段中 d_ptr 是链接地址, 加上装载偏移才是实际地址
+static const void* vdso_ptr(long bias, unsigned long addr) {
+    return reinterpret_cast<const void*>(addr + bias);
+}
+
+// 动态符号个数: 优先用 DT_HASH 的 nchain, 只有 DT_GNU_HASH 时按最大的桶走到链尾
+static unsigned vdso_nsyms(const Elf64_Word* hash, const Elf64_Word* gnu) {
+    if (hash)
+        return hash[1];
+    if (!gnu)
+        return 0;
+    Elf64_Word nbuckets = gnu[0], symoffset = gnu[1], bloom_size = gnu[2];
+    const Elf64_Word* buckets = gnu + 4 + bloom_size * 2; // bloom 为 64 位字
+    const Elf64_Word* chain = buckets + nbuckets;
+    Elf64_Word last = 0;
+    for (Elf64_Word i = 0; i < nbuckets; ++i)
+        if (buckets[i] > last)
+            last = buckets[i];
+    if (last < symoffset)
+        return symoffset;
+    while (!(chain[last - symoffset] & 1))
+        ++last;
+    return last + 1;
+}
+
+static void vdso_init(long* auxv) {
+    unsigned long base = 0;
+    for (long* a = auxv; a[0] != AT_NULL; a += 2)
+        if (a[0] == AT_SYSINFO_EHDR)
+            base = a[1];
+    if (!base)
+        return;
+    const Elf64_Ehdr* eh = reinterpret_cast<const Elf64_Ehdr*>(base);
+    const Elf64_Phdr* ph = reinterpret_cast<const Elf64_Phdr*>(base + eh->e_phoff);
+    const Elf64_Dyn* dyn = nullptr;
+    long bias = 0;
+    bool have_load = false;
+    for (int i = 0; i < eh->e_phnum; ++i) {
+        if (ph[i].p_type == PT_LOAD && !have_load) {
+            bias = base + ph[i].p_offset - ph[i].p_vaddr;
+            have_load = true;
+        } else if (ph[i].p_type == PT_DYNAMIC) {
+            dyn = reinterpret_cast<const Elf64_Dyn*>(base + ph[i].p_offset);
+        }
+    }
+    if (!dyn || !have_load)
+        return;
+    const Elf64_Sym* symtab = nullptr;
+    const char* strtab = nullptr;
+    const Elf64_Word *hash = nullptr, *gnu = nullptr;
+    for (; dyn->d_tag != DT_NULL; ++dyn) {
+        if (dyn->d_tag == DT_SYMTAB)
+            symtab = static_cast<const Elf64_Sym*>(vdso_ptr(bias, dyn->d_un.d_ptr));
+        else if (dyn->d_tag == DT_STRTAB)
+            strtab = static_cast<const char*>(vdso_ptr(bias, dyn->d_un.d_ptr));
+        else if (dyn->d_tag == DT_HASH)
+            hash = static_cast<const Elf64_Word*>(vdso_ptr(bias, dyn->d_un.d_ptr));
+        else if (dyn->d_tag == DT_GNU_HASH)
+            gnu = static_cast<const Elf64_Word*>(vdso_ptr(bias, dyn->d_un.d_ptr));
+    }
+    if (!symtab || !strtab)
+        return;
+    unsigned n = vdso_nsyms(hash, gnu);
+    for (unsigned i = 0; i < n; ++i) {
+        const Elf64_Sym* s = &symtab[i];
+        if (ELF64_ST_TYPE(s->st_info) != STT_FUNC || s->st_shndx == SHN_UNDEF)
+            continue;
+        if (strcmp(strtab + s->st_name, "__vdso_clock_gettime") == 0) {
+            vdso_clock_gettime = reinterpret_cast<vdso_clock_fn>(s->st_value + bias);
+            return;
+        }
+    }
+}
+
+// 单调时钟, 纳秒
+static inline unsigned long now_ns() {
+    struct timespec ts;
+    if (!vdso_clock_gettime || vdso_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        sys_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+// 分阶段计时: timing 内建命令打开后, 每行命令结束时打印读入/解析/启动/等待各用了多少时间
+enum { PH_READ, PH_PARSE, PH_SPAWN, PH_WAIT, PH_COUNT };
+static bool timing_enabled;
+static unsigned long phase_ns[PH_COUNT];
+
+static inline unsigned long phase_begin() { return timing_enabled ? now_ns() : 0; }
+static inline void phase_end(int phase, unsigned long start) {
+    if (timing_enabled)
+        phase_ns[phase] += now_ns() - start;
+}
+
+#endif // __CLOCK_H__
@@ -0,0 +1,150 @@
+#ifndef __ENV_H__
+#define __ENV_H__
+
+#include "memory.h"
+#include "mylib.h"
+#include "pathindex.h"
+
+// 变量表: 按名字做开放寻址 (线性探测) 的哈希表, getenv 与 $VAR 展开都不再扫描整个 environ.
+// 每个变量保存完整的 "NAME=value" 串, 导出的变量直接把这个串放进 execve 的 envp;
+// envp 只在导出变量被改动之后, 下一次执行命令之前重建一次.
+// 表和串都在常驻内存 (palloc) 中, 不受 freem 回退影响. unset 只清掉值, 名字留在槽里, 不需要墓碑.
+#define ENV_INIT_CAP 64
+
+struct env_var {
+    char* entry; // "NAME=value", nullptr 表示空槽
+    size_t nlen; // NAME 的长度
+    size_t cap;  // entry 的容量, 新值放得下时原地改写
+    unsigned hash;
+    bool set; // unset 后为 false
+    bool exported;
+};
+
+static struct env_var* env_table;
+static size_t env_mask;
+static size_t env_used; // 占用的槽数 (包括已 unset 的)
+static char** env_vec;  // 导出变量组成的 envp
+static size_t env_vec_cap;
+static bool env_dirty = true;
+
+static inline unsigned env_hash(const char* s, size_t n) { // FNV-1a
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+// 名字所在的槽, 不存在时为应插入的空槽
+static struct env_var* env_slot(const char* name, size_t n, unsigned h) {
+    for (size_t i = h & env_mask;; i = (i + 1) & env_mask) {
+        struct env_var* v = &env_table[i];
+        if (!v->entry || (v->hash == h && v->nlen == n && strncmp(v->entry, name, n) == 0))
+            return v;
+    }
+}
+
+// 负载超过 1/2 时容量翻倍 (旧表留在常驻内存中)
+static void env_reserve() {
+    size_t cap = env_table ? env_mask + 1 : 0;
+    if (env_table && (env_used + 1) * 2 <= cap)
+        return;
+    struct env_var* old = env_table;
+    size_t ncap = cap ? cap * 2 : ENV_INIT_CAP;
+    env_table = static_cast<struct env_var*>(palloc(ncap * sizeof(struct env_var)));
+    env_mask = ncap - 1;
+    for (size_t i = 0; i < cap; ++i)
+        if (old[i].entry)
+            *env_slot(old[i].entry, old[i].nlen, old[i].hash) = old[i];
+}
+
+static inline bool is_path_var(const char* name, size_t n) { return n == 4 && strncmp(name, "PATH", 4) == 0; }
+
+// 返回变量的值, 不存在或已 unset 时为 nullptr
+const char* env_get(const char* name, size_t n) {
+    if (!env_table)
+        return nullptr;
+    struct env_var* v = env_slot(name, n, env_hash(name, n));
+    return v->entry && v->set ? v->entry + n + 1 : nullptr;
+}
+
+// 赋值; value 为 nullptr 时只打导出标记 (export NAME). PATH 改变时重建命令索引
+void env_set(const char* name, size_t n, const char* value, bool exported) {
+    env_reserve();
+    unsigned h = env_hash(name, n);
+    struct env_var* v = env_slot(name, n, h);
+    size_t vlen = value ? strlen(value) : 0;
+    if (!v->entry || (value && n + vlen + 2 > v->cap)) {
+        size_t cap = n + vlen + 2;
+        char* e = static_cast<char*>(palloc(cap));
+        memcpy(e, name, n);
+        e[n] = '=';
+        if (!v->entry)
+            ++env_used;
+        v->entry = e;
+        v->nlen = n;
+        v->cap = cap;
+        v->hash = h;
+    }
+    if (value) {
+        memcpy(v->entry + n + 1, value, vlen + 1);
+        v->set = true;
+    }
+    v->exported |= exported;
+    if (v->exported)
+        env_dirty = true;
+    if (value && is_path_var(name, n))
+        path_index_init(value);
+}
+
+void env_unset(const char* name, size_t n) {
+    if (!env_table)
+        return;
+    struct env_var* v = env_slot(name, n, env_hash(name, n));
+    if (!v->entry || !v->set)
+        return;
+    if (v->exported)
+        env_dirty = true;
+    v->set = v->exported = false;
+    if (is_path_var(name, n))
+        path_index_init(nullptr);
+}
+
+// 导入启动时的环境: 直接引用栈上的 "NAME=value" 串, 第一次改写变长时才复制
+void env_init(char** envp) {
+    for (char** ep = envp; ep && *ep; ++ep) {
+        char* eq = strchr(*ep, '=');
+        if (!eq)
+            continue;
+        size_t n = eq - *ep;
+        env_reserve();
+        unsigned h = env_hash(*ep, n);
+        struct env_var* v = env_slot(*ep, n, h);
+        if (!v->entry)
+            ++env_used;
+        *v = {*ep, n, strlen(*ep) + 1, h, true, true};
+    }
+    const char* path = env_get("PATH", 4);
+    path_index_init(path);
+}
+
+// execve 用的 envp; 导出变量没有变化时直接复用上一次的结果
+char** env_envp() {
+    if (!env_dirty)
+        return env_vec;
+    size_t n = 0;
+    for (size_t i = 0; env_table && i <= env_mask; ++i)
+        n += env_table[i].entry && env_table[i].set && env_table[i].exported;
+    if (n + 1 > env_vec_cap) {
+        env_vec_cap = (n + 1) * 2;
+        env_vec = static_cast<char**>(palloc(env_vec_cap * sizeof(char*)));
+    }
+    size_t k = 0;
+    for (size_t i = 0; env_table && i <= env_mask; ++i)
+        if (env_table[i].entry && env_table[i].set && env_table[i].exported)
+            env_vec[k++] = env_table[i].entry;
+    env_vec[k] = nullptr;
+    env_dirty = false;
+    return env_vec;
+}
+
+#endif // __ENV_H__
@@ -0,0 +1,328 @@
+#ifndef __FORMAT_H__
+#define __FORMAT_H__
+
+#include "mylib.h"
+
+#include <type_traits>
+#include <utility>
+
+// 编译期格式化: 格式串作为模板参数, 在编译期解析成固定的 "追加字面量 / 追加参数" 操作序列,
+// 运行时不再逐字符解释格式串. 参数个数或类型与格式不匹配时直接编译失败.
+//   cprintf<"\r\033[%zuC">(pos);             // 写入 stderr 缓冲, 与 printf 相同
+//   cformat<"%s=%d">(buf, sizeof(buf), k, v); // 带边界, 返回完整输出所需长度
+// 支持的转换: %d %i %u %x %X %o %c %s %p %%, 标志 '-' '0', 宽度, 长度修饰 h l ll z
+namespace fmt {
+
+template <size_t N>
+struct literal {
+    char s[N];
+    constexpr literal(const char (&str)[N]) {
+        for (size_t i = 0; i < N; ++i)
+            s[i] = str[i];
+    }
+};
+
+// 单个操作: conv == 0 时表示格式串中 [begin, begin+len) 这段字面量
+struct op {
+    size_t begin = 0, len = 0;
+    char conv = 0;   // d i u x X o c s p
+    char length = 0; // 0 h l z
+    int flags = 0;   // LEFT | ZEROPAD
+    int width = 0;
+};
+
+// 只声明不定义: 常量求值走到这里即编译失败, 用来报告非法格式串
+void invalid_format_string();
+
+template <size_t N>
+struct program {
+    op ops[N ? N : 1];
+    size_t nops = 0;
+    size_t nargs = 0;
+};
+
+// 解析格式串; ops 为空时只统计操作数
+template <size_t N>
+constexpr size_t parse(const char (&f)[N], op* ops) {
+    size_t n = 0;
+    size_t i = 0;
+    while (i < N - 1) {
+        if (f[i] != '%' || f[i + 1] == '%') {
+            size_t begin = i;
+            if (f[i] == '%') { // "%%" 输出一个 '%'
+                ++begin;
+                i += 2;
+            }
+            while (i < N - 1 && f[i] != '%')
+                ++i;
+            if (ops)
+                ops[n] = op{begin, i - begin};
+            ++n;
+            continue;
+        }
+        op o;
+        ++i;
+        for (;; ++i) {
+            if (f[i] == '-')
+                o.flags |= LEFT;
+            else if (f[i] == '0')
+                o.flags |= ZEROPAD;
+            else
+                break;
+        }
+        while (is_digit(f[i]))
+            o.width = o.width * 10 + (f[i++] - '0');
+        if (f[i] == 'h' || f[i] == 'l' || f[i] == 'z') {
+            o.length = f[i++];
+            if (o.length == 'l' && f[i] == 'l')
+                ++i;
+        }
+        switch (f[i]) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+        case 's':
+        case 'p':
+            o.conv = f[i++];
+            break;
+        default:
+            invalid_format_string();
+        }
+        if (ops)
+            ops[n] = o;
+        ++n;
+    }
+    return n;
+}
+
+template <literal F>
+constexpr auto compile() {
+    constexpr size_t n = parse(F.s, nullptr);
+    program<n> p;
+    p.nops = parse(F.s, p.ops);
+    for (size_t i = 0; i < p.nops; ++i)
+        if (p.ops[i].conv)
+            ++p.nargs;
+    return p;
+}
+
+template <literal F>
+inline constexpr auto program_of = compile<F>();
+
+// 第 I 个操作对应的参数下标
+template <literal F, size_t I>
+constexpr size_t arg_index() {
+    size_t k = 0;
+    for (size_t i = 0; i < I; ++i)
+        if (program_of<F>.ops[i].conv)
+            ++k;
+    return k;
+}
+
+// 参数类型检查: 整数宽度必须与长度修饰一致, %d/%u 还要求符号一致 (%x/%o 不限符号)
+template <typename T>
+constexpr bool accepts(char conv, char length) {
+    using U = std::remove_cv_t<T>;
+    if (conv == 's')
+        return std::is_convertible_v<U, const char*>;
+    if (conv == 'p')
+        return std::is_pointer_v<U>;
+    if (conv == 'c')
+        return std::is_same_v<U, char> || std::is_same_v<U, int>;
+    if (!std::is_integral_v<U> || std::is_same_v<U, bool>)
+        return false;
+    size_t want = length == 'h' ? sizeof(short) : length == 'l' ? sizeof(long) : length == 'z' ? sizeof(size_t) : sizeof(int);
+    if (sizeof(U) != want)
+        return false;
+    if (conv == 'd' || conv == 'i')
+        return std::is_signed_v<U>;
+    return conv != 'u' || std::is_unsigned_v<U>;
+}
+
+// 两位一组的十进制数字表, 每次除以 100 输出两位
+inline constexpr struct digit_pair_table {
+    char d[200];
+    constexpr digit_pair_table() : d() {
+        for (int i = 0; i < 100; ++i) {
+            d[2 * i] = static_cast<char>('0' + i / 10);
+            d[2 * i + 1] = static_cast<char>('0' + i % 10);
+        }
+    }
+} digit_pairs;
+
+// 把无符号数从 end 往前写, 返回起始位置
+inline char* utoa_rev(char* end, unsigned long v, int base, bool upper) {
+    char* p = end;
+    if (base == 10) {
+        while (v >= 100) {
+            const char* dp = digit_pairs.d + 2 * (v % 100);
+            v /= 100;
+            *--p = dp[1];
+            *--p = dp[0];
+        }
+        if (v >= 10) {
+            *--p = digit_pairs.d[2 * v + 1];
+            *--p = digit_pairs.d[2 * v];
+        } else {
+            *--p = static_cast<char>('0' + v);
+        }
+        return p;
+    }
+    const char* dig = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    unsigned shift = base == 16 ? 4 : 3;
+    do {
+        *--p = dig[v & (base - 1)];
+        v >>= shift;
+    } while (v);
+    return p;
+}
+
+// 输出目标: 带边界的字符数组
+struct buf_writer {
+    char* p;
+    char* end;
+    size_t total;
+    void append(const char* s, size_t n) {
+        size_t room = p < end ? end - p : 0;
+        memcpy(p, s, n < room ? n : room);
+        p += n < room ? n : room;
+        total += n;
+    }
+    void fill(char c, int n) {
+        for (; n > 0; --n) {
+            if (p < end)
+                *p++ = c;
+            ++total;
+        }
+    }
+};
+
+// 输出目标: fd 的输出缓冲 (见 mylib.h 的 bwrite)
+struct fd_writer {
+    int fd;
+    size_t total;
+    void append(const char* s, size_t n) {
+        bwrite(fd, s, n);
+        total += n;
+    }
+    void fill(char c, int n) {
+        char pad[16];
+        memset(pad, c, sizeof(pad));
+        for (; n > 0; n -= (int)sizeof(pad))
+            append(pad, n < (int)sizeof(pad) ? n : sizeof(pad));
+    }
+};
+
+template <typename W>
+inline void emit_padded(W& w, const char* s, size_t n, const op& o, char pad) {
+    int gap = o.width - static_cast<int>(n);
+    if (!(o.flags & LEFT))
+        w.fill(pad, gap);
+    w.append(s, n);
+    if (o.flags & LEFT)
+        w.fill(' ', gap);
+}
+
+// 按转换字符选择输出方式 (而不是按参数类型): %p 对 char* 也输出地址
+template <char C, typename W, typename T>
+inline void emit_arg(W& w, const op& o, T v) {
+    if constexpr (C == 's') {
+        const char* s = v ? static_cast<const char*>(v) : "(null)";
+        emit_padded(w, s, strlen(s), o, ' ');
+    } else if constexpr (C == 'p') {
+        char tmp[2 + 16];
+        char* e = tmp + sizeof(tmp);
+        char* b = utoa_rev(e, reinterpret_cast<unsigned long>(v), 16, false);
+        while (b > tmp + 2)
+            *--b = '0';
+        tmp[0] = '0', tmp[1] = 'x';
+        emit_padded(w, tmp, sizeof(tmp), o, ' ');
+    } else if constexpr (C == 'c') {
+        char c = static_cast<char>(v);
+        emit_padded(w, &c, 1, o, ' ');
+    } else {
+        char tmp[24];
+        char* e = tmp + sizeof(tmp);
+        bool neg = false;
+        unsigned long u = static_cast<unsigned long>(v);
+        if constexpr (std::is_signed_v<T>) {
+            if (v < 0) {
+                neg = true;
+                u = -static_cast<unsigned long>(v);
+            }
+        }
+        int base = o.conv == 'x' || o.conv == 'X' ? 16 : o.conv == 'o' ? 8 : 10;
+        char* b = utoa_rev(e, u, base, o.conv == 'X');
+        if (neg && (o.flags & ZEROPAD) && !(o.flags & LEFT)) { // 符号在前导 0 之前
+            w.append("-", 1);
+            op rest = o;
+            rest.width = o.width - 1;
+            emit_padded(w, b, e - b, rest, '0');
+            return;
+        }
+        if (neg)
+            *--b = '-';
+        emit_padded(w, b, e - b, o, (o.flags & ZEROPAD) && !(o.flags & LEFT) ? '0' : ' ');
+    }
+}
+
+template <size_t J, typename T, typename... Rest>
+inline decltype(auto) nth(T&& t, Rest&&... rest) {
+    if constexpr (J == 0)
+        return static_cast<T&&>(t);
+    else
+        return nth<J - 1>(static_cast<Rest&&>(rest)...);
+}
+
+template <literal F, size_t I, typename W, typename... Args>
+inline void step(W& w, Args&... args) {
+    constexpr op o = program_of<F>.ops[I];
+    if constexpr (o.conv == 0) {
+        w.append(F.s + o.begin, o.len);
+    } else {
+        constexpr size_t k = arg_index<F, I>();
+        using T = std::decay_t<decltype(nth<k>(args...))>;
+        static_assert(accepts<T>(o.conv, o.length), "format argument type does not match its conversion");
+        emit_arg<o.conv>(w, o, nth<k>(args...));
+    }
+}
+
+template <literal F, typename W, typename... Args, size_t... I>
+inline void run(W& w, std::index_sequence<I...>, Args&... args) {
+    (step<F, I>(w, args...), ...);
+}
+
+template <literal F, typename W, typename... Args>
+inline void format_to(W& w, Args&... args) {
+    static_assert(program_of<F>.nargs == sizeof...(Args), "format argument count mismatch");
+    run<F>(w, std::make_index_sequence<program_of<F>.nops>{}, args...);
+}
+
+} // namespace fmt
+
+template <fmt::literal F, typename... Args>
+inline int cformat(char* out, size_t size, Args... args) {
+    fmt::buf_writer w{out, size ? out + size - 1 : out, 0};
+    fmt::format_to<F>(w, args...);
+    if (size > 0)
+        *w.p = '\0';
+    return static_cast<int>(w.total);
+}
+
+template <fmt::literal F, typename... Args>
+inline int cdprintf(int fd, Args... args) {
+    fmt::fd_writer w{fd, 0};
+    fmt::format_to<F>(w, args...);
+    return static_cast<int>(w.total);
+}
+
+template <fmt::literal F, typename... Args>
+inline int cprintf(Args... args) {
+    return cdprintf<F>(STDERR_FILENO, args...);
+}
+
+#endif // __FORMAT_H__
@@ -1,21 +1,47 @@
 #ifndef __HISTORY_H__
 #define __HISTORY_H__
 
+#include "format.h"
 #include "memory.h"
 #include "mylib.h"
+#include "syscall.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // 光标操作宏定义
 #define CURSOR_SAVE    "\033[s"  // 保存光标位置
 #define CURSOR_RESTORE "\033[u"  // 恢复光标位置
 #define CLEAR_LINE     "\033[2K" // 清除整行
 
-// 历史记录
-#define MAX_HISTORY 50
-static char* history[MAX_HISTORY];
+// 历史记录: 固定容量的环, 条目本身连续存放在一块字节区 (arena) 里, 条目表只记偏移和长度.
+// 追加时写在 arena 的写指针处, 放不下就回到开头; 与新条目重叠的最旧条目依次淘汰, 追加和淘汰都是 O(1).
+// 整个结构就是 $HOME/.mysh_history 文件的内容, 以 MAP_SHARED 映射, 修改直接落到文件里;
+// 打不开文件时退回到不持久化的匿名内存.
+#define MAX_HISTORY    1000
+#define HIST_ARENA     (64 * 1024)
+#define HIST_LINE_MAX  4096 // 更长的行不记录
+#define HIST_MAGIC     0x3153494853594d00UL // "\0MYSHIS1"
+
+struct hist_entry {
+    unsigned pos, len; // 在 arena 中的偏移与长度 (不含 '\0')
+};
+
+struct hist_store {
+    unsigned long magic;
+    unsigned first, count; // 最旧条目在 entries 中的下标, 条目数
+    unsigned wpos;         // arena 的写指针
+    unsigned pad;
+    struct hist_entry entries[MAX_HISTORY];
+    char arena[HIST_ARENA];
+};
+
+static struct hist_store* hist;
 static int hist_count = 0;  // 实际存储的历史数量
 static int hist_pos = -1;   // 当前显示的历史索引
 static size_t edit_pos = 0; // 当前编辑位置
-static char temp_buf[256];  // 保存当前未提交的输入
+static char* temp_buf;      // 保存当前未提交的输入
+static size_t temp_cap;
 // static bool mid_edit = false;
 
 void save_current(char* buf, int max_len);
@@ -23,6 +49,54 @@ void restore_current(char* buf, int max_len);
 void load_history(char* buf, int max_len, int index);
 void refresh_line(const char* buf, const char* prompt, size_t edit_pos);
 
+// 第 index 条 (0 为最旧) 的内容
+static inline const char* hist_at(int index, unsigned* len) {
+    const struct hist_entry* e = &hist->entries[(hist->first + index) % MAX_HISTORY];
+    *len = e->len;
+    return hist->arena + e->pos;
+}
+
+// 映射的文件来自上一次会话 (或被改坏), 检查每个字段都在范围内, 否则清空
+static bool hist_valid(const struct hist_store* h) {
+    if (h->magic != HIST_MAGIC || h->first >= MAX_HISTORY || h->count > MAX_HISTORY || h->wpos > HIST_ARENA)
+        return false;
+    for (unsigned i = 0; i < h->count; ++i) {
+        const struct hist_entry* e = &h->entries[(h->first + i) % MAX_HISTORY];
+        if (e->len > HIST_LINE_MAX || e->pos + e->len >= HIST_ARENA || h->arena[e->pos + e->len] != '\0')
+            return false;
+    }
+    return true;
+}
+
+// 打开并映射历史文件; home 为空或失败时只在内存中保存
+void history_init(const char* home) {
+    char file[512];
+    int fd = -1;
+    if (home && cformat<"%s/.mysh_history">(file, sizeof(file), home) < (int)sizeof(file))
+        fd = sys_open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (fd >= 0 && sys_fstat(fd, &st) == 0 && (st.st_size == sizeof(struct hist_store) || sys_ftruncate(fd, sizeof(struct hist_store)) == 0)) {
+        void* p = sys_mmap(nullptr, sizeof(struct hist_store), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (!mmap_failed(p))
+            hist = static_cast<struct hist_store*>(p);
+    }
+    if (fd >= 0)
+        sys_close(fd); // 映射在关闭 fd 后仍然有效
+    if (!hist)
+        hist = static_cast<struct hist_store*>(palloc(sizeof(struct hist_store)));
+    if (!hist_valid(hist)) {
+        memset(hist, 0, offsetof(struct hist_store, entries));
+        hist->magic = HIST_MAGIC;
+    }
+    hist_count = hist->count;
+}
+
+// 退出前把映射的修改写回磁盘
+void history_sync() {
+    if (hist)
+        sys_msync(hist, sizeof(struct hist_store), MS_SYNC);
+}
+
 // 处理方向键
 void handle_arrow(char c, char* buf, int max_len, const char* prompt) {
     if (c == 'A' && hist_count > 0) { // 上键
@@ -53,35 +127,53 @@ void handle_arrow(char c, char* buf, int max_len, const char* prompt) {
     refresh_line(buf, prompt, edit_pos);
 }
 
-// 添加历史记录
+// 添加历史记录: 空行, 过长的行以及与上一条完全相同的行不记录
 void add_history(const char* buf) {
-    if (edit_pos > 0) {
-        if (hist_count >= MAX_HISTORY) {
-            free(history[0]);
-            memmove_z(history, history + 1, (MAX_HISTORY - 1) * sizeof(char*));
-            hist_count--;
-        }
-        if (hist_count != 0) {
-            const char* last = history[hist_count - 1];
-            if (strncmp(last, buf, strlen(buf)) == 0) {
-                return; // 内容不同才添加
-            }
-        }
-        history[hist_count++] = strdup_z(buf);
+    size_t len = strlen(buf);
+    if (!hist || len == 0 || len > HIST_LINE_MAX)
+        return;
+    if (hist->count > 0) {
+        unsigned last_len;
+        const char* last = hist_at(hist->count - 1, &last_len);
+        if (last_len == len && strncmp(last, buf, len) == 0)
+            return;
+    }
+    unsigned need = len + 1;
+    if (hist->wpos + need > HIST_ARENA) // 尾部放不下, 从 arena 开头继续写
+        hist->wpos = 0;
+    // 淘汰与 [wpos, wpos + need) 重叠的最旧条目; 条目表满时也淘汰一条
+    while (hist->count > 0) {
+        const struct hist_entry* old = &hist->entries[hist->first];
+        bool overlap = old->pos >= hist->wpos && old->pos < hist->wpos + need;
+        if (!overlap && hist->count < MAX_HISTORY)
+            break;
+        hist->first = (hist->first + 1) % MAX_HISTORY;
+        hist->count--;
     }
+    struct hist_entry* e = &hist->entries[(hist->first + hist->count) % MAX_HISTORY];
+    memcpy(hist->arena + hist->wpos, buf, need);
+    e->pos = hist->wpos;
+    e->len = len;
+    hist->wpos += need;
+    hist->count++;
+    hist_count = hist->count;
 }
 
 // 保存当前输入
 void save_current(char* buf, int max_len) {
     size_t len = strlen(buf);
     len = len < max_len - 1 ? len : max_len - 1;
+    if (len + 1 > temp_cap) { // 与行缓冲一样按需扩容
+        temp_cap = len + 1 > 2 * temp_cap ? len + 1 : 2 * temp_cap;
+        temp_buf = static_cast<char*>(zalloc(temp_cap));
+    }
     memcpy(temp_buf, buf, len);
     temp_buf[len] = '\0';
 }
 
 // 恢复当前输入
 void restore_current(char* buf, int max_len) {
-    size_t len = strlen(temp_buf);
+    size_t len = temp_buf ? strlen(temp_buf) : 0;
     len = len < max_len - 1 ? len : max_len - 1;
     memcpy(buf, temp_buf, len);
     buf[len] = '\0';
@@ -91,8 +183,12 @@ void restore_current(char* buf, int max_len) {
 // 加载历史记录
 void load_history(char* buf, int max_len, int index) {
     if (index >= 0 && index < hist_count) {
-        strncpy(buf, history[index], max_len);
-        edit_pos = strlen(history[index]);
+        unsigned len;
+        const char* h = hist_at(index, &len);
+        len = len < (unsigned)max_len - 1 ? len : max_len - 1;
+        memcpy(buf, h, len);
+        buf[len] = '\0';
+        edit_pos = len;
     }
 }
 
@@ -104,7 +200,6 @@ void refresh_line(const char* buf, const char* prompt, size_t edit_pos) {
     } else {
         print("? > ", nullptr);
     }
-    // fflush(buf);
     print(buf, nullptr);
     size_t prompt_len = 0;
     if (prompt) {
@@ -114,7 +209,7 @@ void refresh_line(const char* buf, const char* prompt, size_t edit_pos) {
     }
     // 计算光标最终位置 (提示符长度 + 当前编辑位置)
     size_t total_pos = prompt_len + edit_pos;
-    printf("\r\033[%dC", total_pos);
+    cprintf<"\r\033[%zuC">(total_pos);
 }
 
 // handle
@@ -131,11 +226,8 @@ void handle_backspace(char* buf, const char* prompt) {
 void handle_delete(char* buf, const char* prompt) {
     size_t len = strlen(buf);
     if (edit_pos < len) {
-        // 安全删除，确保不超过缓冲区
-        if (len < 256 - 1) {
-            memmove_z(buf + edit_pos, buf + edit_pos + 1, len - edit_pos);
-            buf[len - 1] = '\0';
-        }
+        memmove_z(buf + edit_pos, buf + edit_pos + 1, len - edit_pos);
+        buf[len - 1] = '\0';
     }
     refresh_line(buf, prompt, edit_pos);
 }
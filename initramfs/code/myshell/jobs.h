@@ -0,0 +1,133 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include "format.h"
+#include "mylib.h"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+// 后台作业表 + 事件循环.
+// SIGCHLD 被屏蔽后改由 signalfd 接收, 与 stdin 一起挂在 epoll 上: 等待输入时顺带回收结束的后台作业,
+// 结果在下一个提示符前报告. 前台命令只按确切的 pid 等待, 不会误收后台作业.
+#define MAX_JOBS     32
+#define JOB_TEXT_LEN 64
+
+struct job {
+    int id; // 0 表示空槽
+    int pid;
+    bool done;
+    int status; // wait4 得到的原始状态
+    char text[JOB_TEXT_LEN];
+};
+
+static struct job jobs[MAX_JOBS];
+static unsigned long orig_sigmask; // 子进程 execve 前恢复
+static int sigchld_fd = -1, event_fd = -1;
+static bool stdin_polled;
+static bool jobs_verbose = true; // 非交互 (脚本) 模式下不打印作业编号与结束报告
+
+// 屏蔽 SIGCHLD 并建立 signalfd 与 epoll; stdin 不支持 epoll (如普通文件) 时直接阻塞读
+void jobs_init() {
+    unsigned long mask = 1UL << (SIGCHLD - 1);
+    sys_rt_sigprocmask(SIG_BLOCK, &mask, &orig_sigmask);
+    sigchld_fd = sys_signalfd4(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    event_fd = sys_epoll_create1(EPOLL_CLOEXEC);
+    if (sigchld_fd < 0 || event_fd < 0)
+        return;
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = sigchld_fd;
+    sys_epoll_ctl(event_fd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+    ev.data.fd = STDIN_FILENO;
+    stdin_polled = sys_epoll_ctl(event_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+}
+
+// 子进程在 execve 之前调用, 恢复原来的信号屏蔽字
+inline void jobs_child_reset() { sys_rt_sigprocmask(SIG_SETMASK, &orig_sigmask, nullptr); }
+
+int job_add(int pid, const char* text) {
+    if (pid < 0)
+        return -1;
+    int id = 1;
+    struct job* slot = nullptr;
+    for (auto& j : jobs) {
+        if (j.id == 0 && !slot)
+            slot = &j;
+        else if (j.id >= id)
+            id = j.id + 1;
+    }
+    if (!slot) { // 作业表已满: 不再跟踪, 由下次回收时顺带收掉
+        print("mysh: too many background jobs\n", nullptr);
+        return -1;
+    }
+    *slot = {};
+    slot->id = id;
+    slot->pid = pid;
+    size_t len = strlen(text);
+    memcpy(slot->text, text, len < JOB_TEXT_LEN ? len : JOB_TEXT_LEN - 1);
+    if (jobs_verbose)
+        cprintf<"[%d] %d\n">(id, pid);
+    return id;
+}
+
+// 非阻塞回收已结束的子进程并按 pid 记到作业表里.
+// 只在提示符处调用, 此时没有前台子进程, 收到的都是后台作业 (作业表满时未登记的也一并收掉)
+void job_reap() {
+    int pid, status;
+    while ((pid = sys_wait4(-1, &status, WNOHANG, nullptr)) > 0) {
+        for (auto& j : jobs) {
+            if (j.id != 0 && j.pid == pid) {
+                j.done = true;
+                j.status = status;
+                break;
+            }
+        }
+    }
+}
+
+// 在提示符前报告已结束的作业并释放槽位
+void job_report() {
+    for (auto& j : jobs) {
+        if (j.id == 0 || !j.done)
+            continue;
+        if (!jobs_verbose) {
+            j.id = 0;
+            continue;
+        }
+        if (WIFEXITED(j.status) && WEXITSTATUS(j.status) == 0)
+            cprintf<"[%d]  Done        %s\n">(j.id, j.text);
+        else if (WIFEXITED(j.status))
+            cprintf<"[%d]  Exit %-6d  %s\n">(j.id, WEXITSTATUS(j.status), j.text);
+        else
+            cprintf<"[%d]  Signal %-4d  %s\n">(j.id, WTERMSIG(j.status), j.text);
+        j.id = 0;
+    }
+}
+
+// 阻塞直到 stdin 可读; 期间到达的 SIGCHLD 在这里处理
+void wait_stdin() {
+    if (!stdin_polled)
+        return;
+    while (true) {
+        struct epoll_event evs[2];
+        int n = sys_epoll_wait(event_fd, evs, 2, -1);
+        bool ready = false;
+        for (int i = 0; i < n; ++i) {
+            if (evs[i].data.fd == sigchld_fd) {
+                struct signalfd_siginfo si;
+                while (sys_read(sigchld_fd, &si, sizeof(si)) == sizeof(si))
+                    ;
+                job_reap();
+            } else {
+                ready = true;
+            }
+        }
+        if (ready)
+            return;
+    }
+}
+
+#endif // __JOBS_H__
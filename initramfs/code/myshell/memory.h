@@ -3,14 +3,44 @@
 
 #include "mylib.h"
 
-static char mem[40960], *freem = mem;
+#include <sys/mman.h>
+
+// 堆从程序的 brk 起点开始线性分配, 用完时通过 brk 向上扩展 (每次至少 HEAP_GROW 字节)
+// 临时内存的释放方式不变: 记下 freem, 用完后把 freem 设回去
+#define HEAP_GROW (64 * 1024)
+static char *heap_end, *freem;
 
 void* zalloc(size_t sz) {
+    if (!freem)
+        freem = heap_end = (char*)sys_brk(nullptr);
     freem = (char*)(((__intptr_t)freem + 7) & ~(__intptr_t)7);
-    assert(freem + sz < mem + sizeof(mem));
+    if (freem + sz > heap_end) {
+        size_t need = (freem + sz - heap_end + HEAP_GROW - 1) & ~(size_t)(HEAP_GROW - 1);
+        char* brk = (char*)sys_brk(heap_end + need);
+        assert(brk == heap_end + need);
+        heap_end = brk;
+    }
     void* ret = freem;
     freem += sz;
-    return ret;
+    return memset(ret, 0, sz); // 回收后重用的内存不一定是 0
+}
+// 常驻内存: 从 mmap 得到的大块中线性分配, 不受 freem 回退的影响.
+// 用于 PATH 索引这类可能在命令执行期间重建、又必须一直保留的数据
+#define PERM_CHUNK (256 * 1024)
+static char *perm_cur, *perm_end;
+
+void* palloc(size_t sz) {
+    sz = (sz + 7) & ~(size_t)7;
+    if (perm_cur + sz > perm_end) {
+        size_t len = sz > PERM_CHUNK ? (sz + 4095) & ~(size_t)4095 : PERM_CHUNK;
+        void* p = sys_mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(!mmap_failed(p));
+        perm_cur = static_cast<char*>(p);
+        perm_end = perm_cur + len;
+    }
+    void* ret = perm_cur;
+    perm_cur += sz;
+    return ret; // 新映射的页总是 0
 }
 void free(void* ptr) {
     // 简单实现不回收内存，实际需要根据内存管理器设计
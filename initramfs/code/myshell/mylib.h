@@ -4,6 +4,7 @@
 #include "syscall.h"
 
 #include <cstddef>
+#include <cerrno>
 #include <fcntl.h>
 
 #define LEFT    0x01
@@ -15,7 +16,7 @@
 
 #define is_digit(c) ((c) >= '0' && (c) <= '9')
 static int get_wid(const char** s);
-static char* number_to_string(char* str, long num, int base, int size, int type);
+static char* number_to_string(char* str, char* end, long num, int base, int size, int type);
 
 // Minimum runtime library
 inline size_t strlen(const char* s) {
@@ -25,29 +26,11 @@ inline size_t strlen(const char* s) {
     return len;
 }
 
-void print(const char* s, ...) {
-    va_list ap;
-    va_start(ap, s);
-    struct iovec vecs[16];
-    size_t count = 0;
-    while (s && count < 16) {
-        vecs[count].iov_base = (void*)s;
-        vecs[count].iov_len = strlen(s);
-        count++;
-        s = va_arg(ap, const char*);
-    }
-    va_end(ap);
-
-    if (count > 0) {
-        syscall(SYS_writev, 2, vecs, count);
-    }
-}
-
 #define assert(cond)                                                                                                   \
     do {                                                                                                               \
         if (!(cond)) {                                                                                                 \
             print("\nassert panic.\n", nullptr);                                                                       \
-            syscall(SYS_exit, 1);                                                                                      \
+            exit(1);                                                                                                   \
         }                                                                                                              \
     } while (0)
 
@@ -74,6 +57,11 @@ inline int strncmp(const char* s1, const char* s2, size_t n) {
     }
     return 0;
 }
+inline int strcmp(const char* s1, const char* s2) {
+    while (*s1 && *s1 == *s2)
+        ++s1, ++s2;
+    return static_cast<unsigned char>(*s1) - static_cast<unsigned char>(*s2);
+}
 inline char* strcpy(char* dest, const char* src) {
     char* original_dest = dest;
     while (*src != '\0') {
@@ -169,21 +157,106 @@ inline char* strtok(char* str, const char* delim) {
     return strtok_r(str, delim, &saved);
 }
 
-void fflush(const char* buf) { syscall(SYS_write, 1, buf, strlen(buf)); }
+// 输出缓冲: 每个 fd 一块缓冲区, 只在缓冲满、fork/exec 前、阻塞读之前以及退出时真正写出
+#define OUTBUF_SIZE 4096
+struct outbuf {
+    int fd;
+    size_t len;
+    char data[OUTBUF_SIZE];
+};
+static struct outbuf outbufs[] = {{STDOUT_FILENO, 0, {}}, {STDERR_FILENO, 0, {}}};
+
+static struct outbuf* outbuf_of(int fd) {
+    for (auto& b : outbufs) {
+        if (b.fd == fd)
+            return &b;
+    }
+    return nullptr; // 其他 fd 不缓冲
+}
+
+static void write_all(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        long r = sys_write(fd, p, n);
+        if (r == -EINTR)
+            continue;
+        if (r <= 0)
+            return;
+        p += r;
+        n -= r;
+    }
+}
+
+void fflush(int fd) {
+    struct outbuf* b = outbuf_of(fd);
+    if (b && b->len > 0) {
+        write_all(fd, b->data, b->len);
+        b->len = 0;
+    }
+}
+
+// fork/execve/阻塞读之前调用, 避免子进程继承未写出的数据或提示符迟迟不显示
+void flush_all() {
+    for (auto& b : outbufs)
+        fflush(b.fd);
+}
+
+void bwrite(int fd, const void* p, size_t n) {
+    struct outbuf* b = outbuf_of(fd);
+    if (!b) {
+        write_all(fd, static_cast<const char*>(p), n);
+        return;
+    }
+    if (b->len + n > OUTBUF_SIZE) {
+        fflush(fd);
+        if (n >= OUTBUF_SIZE) { // 大块数据直接写出, 不再经过缓冲
+            write_all(fd, static_cast<const char*>(p), n);
+            return;
+        }
+    }
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
 
-int vsprintf(char* out, const char* fmt, va_list ap) {
+// 依次输出以 nullptr 结尾的字符串参数到 stderr (参数个数不限)
+void print(const char* s, ...) {
+    va_list ap;
+    va_start(ap, s);
+    while (s) {
+        bwrite(STDERR_FILENO, s, strlen(s));
+        s = va_arg(ap, const char*);
+    }
+    va_end(ap);
+}
+
+[[noreturn]] void exit(int status) {
+    flush_all();
+    sys_exit(status);
+}
+
+// 带边界的格式化: 最多写入 size 字节 (含结尾 '\0'), 返回完整输出所需的长度
+// 支持 h/l/ll/z 长度修饰符, 如 %ld %zu %lx
+static inline char* put_char(char* str, char* end, char c) {
+    if (str < end)
+        *str = c;
+    return str + 1;
+}
+
+int vsnprintf(char* out, size_t size, const char* fmt, va_list ap) {
     int len, i; // 长度
     unsigned long num;
     char* str;
-    char* s;
+    char* end;
+    const char* s;
     int flags = 0;     // 用来指示类型
-    int integer_width; // 整数的长度 如%8d, 8为精度; qualifier: h(短整)或者l(长整)
+    int integer_width; // 整数的长度 如%8d, 8为精度
+    int qualifier;     // 长度修饰: h(短整) l(长整) z(size_t)
     int base;          // 进制
 
+    end = out + size;
     for (str = out; *fmt; fmt++) {
         // 还没有出现需要转化的常规字符
         if (*fmt != '%') {
-            *str++ = *fmt;
+            str = put_char(str, end, *fmt);
             continue;
         }
         flags = 0;
@@ -212,6 +285,14 @@ int vsprintf(char* out, const char* fmt, va_list ap) {
             integer_width = get_wid(&fmt);
         }
 
+        // 长度修饰符, ll 与 l 在 x86_64 上等宽
+        qualifier = 0;
+        if (*fmt == 'h' || *fmt == 'l' || *fmt == 'z') {
+            qualifier = *fmt++;
+            if (qualifier == 'l' && *fmt == 'l')
+                fmt++;
+        }
+
         base = 10; // 默认基
         switch (*fmt) {
         // 指针
@@ -220,67 +301,104 @@ int vsprintf(char* out, const char* fmt, va_list ap) {
                 integer_width = 2 * sizeof(void*);
                 flags |= ZEROPAD;
             }
-            *str++ = '0', *str++ = 'x';
-            str = number_to_string(str, (unsigned long)va_arg(ap, void*), 16, integer_width, flags);
+            str = put_char(str, end, '0');
+            str = put_char(str, end, 'x');
+            str = number_to_string(str, end, (unsigned long)va_arg(ap, void*), 16, integer_width, flags);
             continue;
         // 单字符
         case 'c':
-            *str++ = (unsigned char)va_arg(ap, int);
+            str = put_char(str, end, (unsigned char)va_arg(ap, int));
             continue; // 跳到最外层的for循环
         // 字符串
         case 's':
-            s = va_arg(ap, char*);
+            s = va_arg(ap, const char*);
             if (!s)
-                s = nullptr;
+                s = "(null)";
             len = strlen(s);
             for (i = 0; i < len; ++i)
-                *str++ = *s++;
+                str = put_char(str, end, *s++);
             continue; // 跳到最外层的for循环
+        case '%':
+            str = put_char(str, end, '%');
+            continue;
 
         case 'o':
             base = 8;
             break; // break之后进入num的获取
+        case 'X':
+            flags |= LARGE;
+            [[fallthrough]];
         case 'x':
             base = 16;
             break;
         case 'd':
+        case 'i':
             flags |= SIGN;
+            [[fallthrough]];
         case 'u':
             break;
 
         default:
             assert(0);
-            if (*fmt != '%')
-                *str++ = '%';
-            if (*fmt) {
-                *str++ = *fmt;
-            } else {
-                --fmt;
-            }
             continue;
         }
 
-        // 如果是整型,分两种情况:带不带符号
-        if (flags & SIGN) {
+        // 如果是整型,按长度修饰符和是否带符号取参数
+        if (qualifier == 'l' || qualifier == 'z') {
+            num = (flags & SIGN) ? (unsigned long)va_arg(ap, long) : va_arg(ap, unsigned long);
+        } else if (qualifier == 'h') {
+            num = (flags & SIGN) ? (unsigned long)(short)va_arg(ap, int) : (unsigned short)va_arg(ap, unsigned int);
+        } else if (flags & SIGN) {
             num = va_arg(ap, int);
         } else {
             num = va_arg(ap, unsigned int);
         }
 
         // 将数字转化为字符
-        str = number_to_string(str, num, base, integer_width, flags);
+        str = number_to_string(str, end, num, base, integer_width, flags);
     }
-    *str = '\0';
+    if (size > 0)
+        *(str < end ? str : end - 1) = '\0';
     return str - out;
 }
 
+int snprintf(char* out, size_t size, const char* fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    int ret = vsnprintf(out, size, fmt, va);
+    va_end(va);
+    return ret;
+}
+
+// 直接格式化进 fd 的输出缓冲区, 剩余空间不够时先刷新再重新格式化; 超过整块缓冲的部分被截断
+int vdprintf(int fd, const char* fmt, va_list ap) {
+    struct outbuf* b = outbuf_of(fd);
+    if (!b) {
+        char tmp[512];
+        int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+        write_all(fd, tmp, n < (int)sizeof(tmp) ? n : sizeof(tmp) - 1);
+        return n;
+    }
+    va_list aq;
+    va_copy(aq, ap);
+    size_t room = OUTBUF_SIZE - b->len;
+    int n = vsnprintf(b->data + b->len, room, fmt, aq);
+    va_end(aq);
+    if ((size_t)n < room) {
+        b->len += n;
+        return n;
+    }
+    fflush(fd);
+    n = vsnprintf(b->data, OUTBUF_SIZE, fmt, ap);
+    b->len = (size_t)n < OUTBUF_SIZE ? n : OUTBUF_SIZE - 1;
+    return n;
+}
+
 int printf(const char* fmt, ...) {
-    char out[2048];
     va_list va;
     va_start(va, fmt);
-    int ret = vsprintf(out, fmt, va);
+    int ret = vdprintf(STDERR_FILENO, fmt, va);
     va_end(va);
-    print(out, nullptr);
     return ret;
 }
 
@@ -291,16 +409,17 @@ static int get_wid(const char** s) {
     }
     return i;
 }
-static char* number_to_string(char* str, long num, int base, int size, int type) {
-    const char* dig = "0123456789abcdefghijklmnopqrstuvwxyz";
+static char* number_to_string(char* str, char* end, long num, int base, int size, int type) {
+    const char* dig = (type & LARGE) ? "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ" : "0123456789abcdefghijklmnopqrstuvwxyz";
     char c, sign, temp[70];
+    unsigned long n = num;
     int i = 0;
     c = (type & ZEROPAD) ? '0' : ' '; // 是否补充前导 0
     sign = 0;
 
     if (type & SIGN) {
         if (num < 0) {
-            num = -num;
+            n = -(unsigned long)num;
             sign = '-';
             size--;
         } else if (type & PLUS) {
@@ -312,12 +431,12 @@ static char* number_to_string(char* str, long num, int base, int size, int type)
         }
     }
 
-    if (num == 0) {
+    if (n == 0) {
         temp[i++] = '0';
     } else {
-        while (num != 0) {
-            temp[i++] = dig[((unsigned long)num) % (unsigned)base];
-            num = ((unsigned long)num) / (unsigned)base;
+        while (n != 0) {
+            temp[i++] = dig[n % (unsigned)base];
+            n = n / (unsigned)base;
         }
     }
 
@@ -325,20 +444,20 @@ static char* number_to_string(char* str, long num, int base, int size, int type)
 
     if (!(type & (ZEROPAD | LEFT)))
         while (size-- > 0)
-            *str++ = ' ';
+            str = put_char(str, end, ' ');
 
     if (sign)
-        *str++ = sign;
+        str = put_char(str, end, sign);
 
     if (!(type & LEFT))
         while (size-- > 0)
-            *str++ = c; // 补充前导(0或者space)
+            str = put_char(str, end, c); // 补充前导(0或者space)
     while (i-- > 0)
-        *str++ = temp[i];
+        str = put_char(str, end, temp[i]);
     while (size-- > 0)
-        *str++ = ' ';
+        str = put_char(str, end, ' ');
 
     return str;
 }
 
-#endif // __MYLIB_H__
\ No newline at end of file
+#endif // __MYLIB_H__
@@ -2,135 +2,459 @@
 // gcc -g -O2 -c -ffreestanding -nostdlib -fno-exceptions mysh-xv6.cpp
 // ld mysh-xv6.o -o mysh
 
+#include "clock.h"
+#include "env.h"
 #include "history.h"
+#include "jobs.h"
 #include "memory.h"
 #include "mylib.h"
 #include "mysh.h"
+#include "pathindex.h"
+#include "spawn.h"
 #include "termios.h"
 
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
 // my var
-char** environ = nullptr; // 全局环境变量表指针
 const char* path;
+static int last_status; // $? 的值
+
+char* getcwd(char* buf, size_t size) { return (sys_getcwd(buf, size) >= 0) ? buf : nullptr; }
+
+char* getenv(const char* name) { return const_cast<char*>(env_get(name, strlen(name))); }
+
+// 在 PATH 索引中查找命令; 未命中时先重新验证索引 (可能是新安装的命令) 再查一次
+const char* findPath(const char* cmd) {
+    static char buf[512];
+    if (strchr(cmd, '/'))
+        return cmd;
+    if (path_index_lookup(cmd, buf, sizeof(buf)))
+        return buf;
+    if (path_index_revalidate() && path_index_lookup(cmd, buf, sizeof(buf)))
+        return buf;
+    return cmd;
+}
+
+// fork 之前先刷新输出缓冲, 否则父子进程会各自写出一份.
+// 终端模式只由交互的 shell 进程在启动前台命令时切换 (见 runcmd), 子 shell 不碰终端设置
+int fork() {
+    flush_all();
+    unsigned long t = phase_begin();
+    int pid = sys_fork();
+    if (pid != 0)
+        phase_end(PH_SPAWN, t);
+    else
+        raw_active = false;
+    return pid;
+}
+
+// 等待指定的子进程, 返回 shell 风格的退出状态
+static int wait_status(int pid) {
+    int status = 0;
+    if (pid < 0)
+        return 127;
+    unsigned long t = phase_begin();
+    while (sys_wait4(pid, &status, 0, nullptr) == -EINTR)
+        ;
+    phase_end(PH_WAIT, t);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// 剥掉 REDIR 链, 返回最里面的 EXEC; 不是简单命令时返回 nullptr
+static struct execcmd* simple_exec(struct cmd* cmd) {
+    while (cmd && cmd->type == REDIR)
+        cmd = ((struct redircmd*)cmd)->cmd;
+    return (cmd && cmd->type == EXEC) ? (struct execcmd*)cmd : nullptr;
+}
+
+// clone_vfork 子进程的参数, 放在父进程栈上 (父进程此时挂起).
+// 子进程只通过系统调用工作, 失败时把原因写回 err / bad_file, 由父进程输出提示或重试
+struct exec_req {
+    struct cmd* cmd;
+    struct execcmd* ecmd;
+    const char* path;
+    char** envp;
+    int in, out;
+    int err;              // execve 返回的 -errno, 0 表示没有走到 execve 或成功
+    const char* bad_file; // 打不开的重定向文件
+};
+
+// 在子进程中打开重定向文件并放到目标 fd 上
+static bool apply_redir(struct redircmd* rcmd) {
+    int fd = sys_open(rcmd->file, rcmd->mode, 0644);
+    if (fd < 0)
+        return false;
+    if (fd != rcmd->fd) {
+        sys_dup2(fd, rcmd->fd);
+        sys_close(fd);
+    }
+    return true;
+}
+
+static int exec_child(void* arg) {
+    struct exec_req* req = static_cast<struct exec_req*>(arg);
+    jobs_child_reset();
+    if (req->in >= 0)
+        sys_dup2(req->in, 0);
+    if (req->out >= 0)
+        sys_dup2(req->out, 1);
+    for (struct cmd* c = req->cmd; c->type == REDIR; c = ((struct redircmd*)c)->cmd) {
+        if (!apply_redir((struct redircmd*)c)) {
+            req->bad_file = ((struct redircmd*)c)->file;
+            return 1;
+        }
+    }
+    if (req->ecmd->argv[0] == 0) // 只有重定向, 如 "> file"
+        return 0;
+    req->err = sys_execve(req->path, req->ecmd->argv, req->envp);
+    return 127;
+}
+
+// 用 clone_vfork 启动简单命令. execve 报 ENOENT 时索引可能已过期 (命令被删除或移动):
+// 在父进程中收掉失败的子进程, 重建索引后再试一次
+static int spawn_exec(struct exec_req* req) {
+    unsigned long t = phase_begin(); // vfork 语义: 子进程 execve 之后才返回, 包含了 execve 的耗时
+    int pid = clone_vfork(exec_child, req);
+    if (pid > 0 && req->err == -ENOENT && path_index_revalidate()) {
+        while (sys_wait4(pid, nullptr, 0, nullptr) == -EINTR)
+            ;
+        req->path = findPath(req->ecmd->argv[0]);
+        req->err = 0;
+        pid = clone_vfork(exec_child, req);
+    }
+    phase_end(PH_SPAWN, t);
+    if (pid > 0 && req->bad_file)
+        print("fail to open ", req->bad_file, "\n", nullptr);
+    else if (pid > 0 && req->err)
+        print("fail to exec ", req->ecmd->argv[0], "\n", nullptr);
+    return pid;
+}
+
+// execve 的参数和环境变量总长度上限, 与内核的计算一致: 栈大小限制的 1/4, 至少 32 页.
+// 超过时 execve 只会返回 E2BIG, 这里提前检查以便给出明确的提示
+#define ARG_MAX_MIN    (32 * 4096)
+#define MAX_ARG_STRLEN (32 * 4096) // 单个参数的上限
+static size_t arg_max = ARG_MAX_MIN;
+
+static void init_arg_max() {
+    struct rlimit r;
+    if (sys_prlimit64(0, RLIMIT_STACK, nullptr, &r) != 0)
+        return;
+    size_t lim = r.rlim_cur == RLIM_INFINITY ? 6 * 1024 * 1024 : r.rlim_cur / 4; // 不限时内核按 _STK_LIM 的 3/4 算
+    if (lim > arg_max)
+        arg_max = lim;
+}
+
+static bool args_fit(char** argv, char** envp) {
+    size_t total = 0;
+    for (char** a = argv; *a; ++a) {
+        size_t n = strlen(*a) + 1;
+        if (n > MAX_ARG_STRLEN)
+            return false;
+        total += n + sizeof(char*);
+    }
+    for (char** e = envp; *e; ++e)
+        total += strlen(*e) + 1 + sizeof(char*);
+    return total <= arg_max;
+}
+
+int runcmd(struct cmd* cmd);
+static inline char* skip_space(char* s, char* es);
+static char* expand_word(const char* s, bool* quoted);
+static void expand_simple(struct cmd* cmd, struct execcmd* ecmd);
+
+// 内建命令 ---------------------------------------------------
+// 只有在 shell 进程中执行才有效果; 在管道中或带重定向时放到 fork 出的子 shell 里执行
+typedef int (*builtin_fn)(char** argv);
+
+static inline bool is_name_char(char c, bool first) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (!first && c >= '0' && c <= '9');
+}
+
+// 变量名的长度; s 不是以合法变量名开头时为 0
+static size_t name_len(const char* s) {
+    size_t n = 0;
+    while (s[n] && is_name_char(s[n], n == 0))
+        ++n;
+    return n;
+}
+
+// NAME=value 形式的单词
+static bool is_assignment(const char* s) {
+    size_t n = name_len(s);
+    return n > 0 && s[n] == '=';
+}
+
+static int builtin_cd(char** argv) {
+    const char* cdpath = argv[1];
+    if (!cdpath) {
+        cdpath = getenv("HOME");
+        if (!cdpath) {
+            print("cd: no HOME directory\n", nullptr);
+            return 1;
+        }
+    }
+    // Chdir must be called by the parent
+    if (sys_chdir(cdpath) < 0) {
+        print("cannot cd ", cdpath, "\n", nullptr);
+        return 1;
+    }
+    return 0;
+}
+
+// NAME=value ...: 只设置 shell 变量 (已导出的变量仍保持导出)
+static int builtin_assign(char** argv) {
+    for (char** a = argv; *a; ++a) {
+        size_t n = name_len(*a);
+        env_set(*a, n, *a + n + 1, false);
+    }
+    return 0;
+}
+
+// export [NAME[=value] ...]; 不带参数时列出所有导出变量
+static int builtin_export(char** argv) {
+    if (!argv[1]) {
+        for (char** e = env_envp(); *e; ++e)
+            cdprintf<"export %s\n">(STDOUT_FILENO, *e);
+        return 0;
+    }
+    int status = 0;
+    for (char** a = argv + 1; *a; ++a) {
+        size_t n = name_len(*a);
+        if (n == 0 || ((*a)[n] != '=' && (*a)[n] != '\0')) {
+            print("export: bad variable name: ", *a, "\n", nullptr);
+            status = 1;
+            continue;
+        }
+        env_set(*a, n, (*a)[n] == '=' ? *a + n + 1 : nullptr, true);
+    }
+    return status;
+}
+
+// timing [on|off]: 打开/关闭分阶段计时, 不带参数时切换
+static int builtin_timing(char** argv) {
+    if (!argv[1])
+        timing_enabled = !timing_enabled;
+    else if (strcmp(argv[1], "on") == 0)
+        timing_enabled = true;
+    else if (strcmp(argv[1], "off") == 0)
+        timing_enabled = false;
+    else {
+        print("usage: timing [on|off]\n", nullptr);
+        return 2;
+    }
+    for (auto& ns : phase_ns)
+        ns = 0;
+    return 0;
+}
 
-char* getcwd(char* buf, size_t size) { return (syscall(SYS_getcwd, buf, size) >= 0) ? buf : nullptr; }
+static int builtin_unset(char** argv) {
+    for (char** a = argv + 1; *a; ++a)
+        env_unset(*a, strlen(*a));
+    return 0;
+}
 
-char* getenv(const char* name) {
-    if (environ == nullptr) {
-        print("Environment is empty.\n", nullptr);
+// 命令对应的内建实现; 全部由赋值组成的命令也算作内建命令
+static builtin_fn find_builtin(char** argv) {
+    if (!argv[0])
         return nullptr;
+    if (strcmp(argv[0], "cd") == 0)
+        return builtin_cd;
+    if (strcmp(argv[0], "export") == 0)
+        return builtin_export;
+    if (strcmp(argv[0], "unset") == 0)
+        return builtin_unset;
+    if (strcmp(argv[0], "timing") == 0)
+        return builtin_timing;
+    for (char** a = argv; *a; ++a)
+        if (!is_assignment(*a))
+            return nullptr;
+    return builtin_assign;
+}
+
+// 启动 cmd 但不等待, 返回 pid. in/out 接到子进程的 0/1 上 (-1 表示继承),
+// close_fd 是子 shell 中需要关掉的管道另一端.
+// 简单命令用 clone_vfork 直接 execve; 只有复合命令才 fork 出有独立地址空间的子 shell
+static int spawncmd(struct cmd* cmd, int in, int out, int close_fd) {
+    struct execcmd* ecmd = simple_exec(cmd);
+    if (ecmd)
+        expand_simple(cmd, ecmd);
+    if (ecmd && !find_builtin(ecmd->argv)) {
+        char** envp = env_envp();
+        if (ecmd->argv[0] && !args_fit(ecmd->argv, envp)) {
+            print("mysh: ", ecmd->argv[0], ": argument list too long\n", nullptr);
+            return -1;
+        }
+        struct exec_req req = {cmd, ecmd, ecmd->argv[0] ? findPath(ecmd->argv[0]) : nullptr, envp, in, out, 0, nullptr};
+        flush_all();
+        return spawn_exec(&req);
     }
-    size_t name_len = strlen(name);
-    for (char** ep = environ; *ep; ++ep) {
-        char* eq_pos = strchr(*ep, '=');
-        if (eq_pos && (eq_pos - *ep) == name_len) {
-            if (strncmp(*ep, name, name_len) == 0) {
-                return eq_pos + 1;
-            }
+    int pid = fork();
+    if (pid == 0) {
+        jobs_child_reset();
+        if (close_fd >= 0)
+            sys_close(close_fd);
+        if (in >= 0) {
+            sys_dup2(in, 0);
+            sys_close(in);
         }
+        if (out >= 0) {
+            sys_dup2(out, 1);
+            sys_close(out);
+        }
+        exit(runcmd(cmd));
     }
-    return nullptr;
+    return pid;
 }
 
-const char* findPath(const char* cmd) {
-    static char buf[512];
-    char* path_copy = static_cast<char*>(zalloc(strlen(path) + 1));
-    strcpy(path_copy, path);
-    char* dir = strtok(path_copy, ":");
-    while (dir) {
-        char* p = buf;
-        strcpy(p, dir);
-        p += strlen(dir);
-        *p++ = '/';
-        strcpy(p, cmd);
-        p += strlen(cmd);
-        if (syscall(SYS_access, buf, X_OK) == 0) {
-            freem = path_copy; // 释放临时内存
-            return buf;
+// a | b | c 被解析成 pipecmd(a, pipecmd(b, c)), 依次启动每一段, 最后按 pid 逐个等待
+static int runpipe(struct pipecmd* pcmd) {
+    int n = 1;
+    for (struct cmd* c = (struct cmd*)pcmd; c->type == PIPE; c = ((struct pipecmd*)c)->right)
+        n++;
+    int* pids = static_cast<int*>(zalloc(n * sizeof(int)));
+    int in = -1, k = 0;
+    struct cmd* c = (struct cmd*)pcmd;
+    for (; c->type == PIPE; c = ((struct pipecmd*)c)->right) {
+        int p[2]; // 带 O_CLOEXEC, 子进程 execve 后只剩 dup2 到 0/1 的那一端
+        if (sys_pipe2(p, O_CLOEXEC) < 0) {
+            print("pipe failed\n", nullptr);
+            break;
         }
-        dir = strtok(nullptr, ":");
+        pids[k++] = spawncmd(((struct pipecmd*)c)->left, in, p[1], p[0]);
+        sys_close(p[1]);
+        if (in >= 0)
+            sys_close(in);
+        in = p[0];
     }
-    freem = path_copy; // 释放临时内存
-    return cmd;
+    if (c->type != PIPE)
+        pids[k++] = spawncmd(c, in, -1, -1);
+    if (in >= 0)
+        sys_close(in);
+    int status = 0;
+    for (int i = 0; i < k; ++i)
+        status = wait_status(pids[i]);
+    return status;
 }
 
-// run cmd 保证不会return
-void runcmd(struct cmd* cmd) {
-    int p[2];
-    const char* fullPath;
+// 在 shell 进程中执行命令树, 返回退出状态
+int runcmd(struct cmd* cmd) {
+    int pid;
     struct backcmd* bcmd;
-    struct execcmd* ecmd;
     struct listcmd* lcmd;
-    struct pipecmd* pcmd;
     struct redircmd* rcmd;
+    struct execcmd* ecmd;
+    builtin_fn builtin;
 
     if (cmd == 0)
-        syscall(SYS_exit, 1);
+        return 0;
 
     switch (cmd->type) {
     case EXEC:
-        ecmd = (struct execcmd*)cmd;
-        if (ecmd->argv[0] == 0)
-            syscall(SYS_exit, 1);
-        fullPath = findPath(ecmd->argv[0]);
-        syscall(SYS_execve, fullPath, ecmd->argv, environ);
-        print("fail to exec ", ecmd->argv[0], "\n", nullptr);
-        break;
-
     case REDIR:
+        if ((ecmd = simple_exec(cmd))) {
+            expand_simple(cmd, ecmd);
+            builtin = find_builtin(ecmd->argv);
+            if (!builtin) {
+                // 前台命令可能读终端: 先切回规范模式, 下次读命令时 getcmd 再切回原始模式.
+                // 后台命令 (BACK) 不切换, 原始模式和其中预先键入的内容都保持不变
+                disable_raw_mode();
+                return wait_status(spawncmd(cmd, -1, -1, -1));
+            }
+            if (cmd->type == EXEC)
+                return builtin(ecmd->argv);
+        }
+        // 复合命令 (或内建命令) 外层的重定向, 如 "(a; b) > f": 在子 shell 中打开后再执行
         rcmd = (struct redircmd*)cmd;
-        syscall(SYS_close, rcmd->fd);
-        if (syscall(SYS_open, rcmd->file, rcmd->mode, 0644) < 0) {
-            print("fail to open ", rcmd->file, "\n", nullptr);
-            syscall(SYS_exit, 1);
+        disable_raw_mode();
+        if ((pid = fork()) == 0) {
+            jobs_child_reset();
+            // 内建命令的文件名已由 expand_simple 展开过, 再展开会丢掉引号
+            if (!ecmd || !ecmd->expanded) {
+                bool quoted;
+                rcmd->file = expand_word(rcmd->file, &quoted);
+            }
+            if (!apply_redir(rcmd)) {
+                print("fail to open ", rcmd->file, "\n", nullptr);
+                exit(1);
+            }
+            exit(runcmd(rcmd->cmd));
         }
-        runcmd(rcmd->cmd);
-        break;
+        return wait_status(pid);
 
     case LIST:
         lcmd = (struct listcmd*)cmd;
-        if (syscall(SYS_fork) == 0)
-            runcmd(lcmd->left);
-        syscall(SYS_wait4, -1, 0, 0, 0);
-        runcmd(lcmd->right);
-        break;
+        last_status = runcmd(lcmd->left); // 右边的命令执行时才展开, 能看到左边的 $?
+        return runcmd(lcmd->right);
 
     case PIPE:
-        pcmd = (struct pipecmd*)cmd;
-        assert(syscall(SYS_pipe, p) >= 0);
-        if (syscall(SYS_fork) == 0) {
-            syscall(SYS_close, 1);    // stdout
-            syscall(SYS_dup, p[1]);   // p[1] 管道的写口
-            syscall(SYS_close, p[0]); // p[0] 管道的读口
-            syscall(SYS_close, p[1]);
-            runcmd(pcmd->left);
-        }
-        if (syscall(SYS_fork) == 0) {
-            syscall(SYS_close, 0);
-            syscall(SYS_dup, p[0]);
-            syscall(SYS_close, p[0]);
-            syscall(SYS_close, p[1]);
-            runcmd(pcmd->right);
-        }
-        syscall(SYS_close, p[0]);
-        syscall(SYS_close, p[1]);
-        syscall(SYS_wait4, -1, 0, 0, 0);
-        syscall(SYS_wait4, -1, 0, 0, 0);
-        break;
+        disable_raw_mode();
+        return runpipe((struct pipecmd*)cmd);
 
     case BACK:
         bcmd = (struct backcmd*)cmd;
-        if (syscall(SYS_fork) == 0)
-            runcmd(bcmd->cmd);
-        break;
+        job_add(spawncmd(bcmd->cmd, -1, -1, -1), bcmd->text);
+        return 0;
 
     default:
         assert(0);
     }
-    syscall(SYS_exit, 0);
+    return 0;
 }
 
-int getcmd(char* buf, int nbuf) {
-    enable_raw_mode(); // 进入原始模式
+// 输入环形缓冲: 每次 read 尽量多读, 一次读到的多行 (快速键入或串口灌入的命令)
+// 留在缓冲里给后面的 getcmd, 不会丢失也不用逐字节做系统调用
+#define INPUT_RING 1024 // 2 的幂
+
+static struct {
+    char data[INPUT_RING];
+    unsigned head, tail; // 只增不减, 取模得到下标
+} input_ring;
+
+// 取一个字节; 缓冲为空时先把输出整体刷出, 再阻塞等待 stdin (期间顺带回收后台作业)
+static long read_key(char* ch) {
+    auto& r = input_ring;
+    if (r.head == r.tail) {
+        flush_all();
+        unsigned long t = phase_begin();
+        wait_stdin();
+        unsigned at = r.tail % INPUT_RING;
+        unsigned room = INPUT_RING - (r.tail - r.head);
+        long n = sys_read(STDIN_FILENO, r.data + at, room < INPUT_RING - at ? room : INPUT_RING - at);
+        phase_end(PH_READ, t);
+        if (n <= 0)
+            return n;
+        r.tail += n;
+    }
+    *ch = r.data[r.head++ % INPUT_RING];
+    return 1;
+}
+
+// 行缓冲: 不限长度, 容量不够时从堆上按倍数扩容 (旧块不回收)
+static char* line_buf;
+static size_t line_cap;
+
+static void line_reserve(size_t n) {
+    if (n <= line_cap)
+        return;
+    size_t cap = line_cap ? line_cap : 128;
+    while (cap < n)
+        cap *= 2;
+    char* p = static_cast<char*>(zalloc(cap));
+    if (line_buf)
+        memcpy(p, line_buf, line_cap);
+    line_buf = p;
+    line_cap = cap;
+}
+
+// 读入一行命令, EOF 时返回 nullptr
+char* getcmd() {
+    job_reap();
+    job_report();
+    enable_raw_mode(); // 进入原始模式 (已经是原始模式时什么也不做)
 
     char cwd[256];
     if (getcwd(cwd, sizeof(cwd))) {
@@ -139,17 +463,17 @@ int getcmd(char* buf, int nbuf) {
         print("? > ", nullptr);
     }
     // 初始化编辑状态
-    memset(buf, 0, nbuf);
+    line_reserve(128);
+    char* buf = line_buf;
+    buf[0] = '\0';
     int esc_state = 0; // ESC状态机：0-正常 1-ESC 2-[
     edit_pos = 0;
     hist_pos = -1;
     while (true) {
         char ch;
-        int nread = syscall(SYS_read, 0, &ch, 1); // 单字符读取
-        if (nread <= 0) {
-            buf[0] = '\0';
-            break;
-        }
+        int nread = read_key(&ch); // 单字符读取
+        if (nread <= 0) // EOF (Ctrl+D 或输入被关闭) 时退出, 而不是反复提交空命令
+            return nullptr;
         // ESC序列处理
         if (esc_state != 0) {
             if (esc_state == 1 && ch == '[') {
@@ -158,12 +482,14 @@ int getcmd(char* buf, int nbuf) {
                 esc_state = 0;
                 if (ch == '3') {
                     char next_ch;
-                    if (syscall(SYS_read, 0, &next_ch, 1) > 0 && next_ch == '~') {
+                    if (read_key(&next_ch) > 0 && next_ch == '~') {
                         handle_delete(buf, cwd);
                     }
                     continue;
                 }
-                handle_arrow(ch, buf, nbuf, cwd);
+                line_reserve(HIST_LINE_MAX + 1); // 历史记录总能完整放进行缓冲
+                buf = line_buf;
+                handle_arrow(ch, buf, line_cap, cwd);
             } else {
                 esc_state = 0;
             }
@@ -172,13 +498,10 @@ int getcmd(char* buf, int nbuf) {
 
         if (ch >= 32 && ch < 127) { // 可打印字符
             size_t len = strlen(buf);
-            if (len < nbuf - 1) { // 确保有空间插入
-                memmove_z(buf + edit_pos + 1, buf + edit_pos, len - edit_pos + 1);
-                buf[edit_pos++] = ch;
-                if (edit_pos > len) {
-                    buf[edit_pos] = '\0';
-                }
-            }
+            line_reserve(len + 2); // 确保有空间插入
+            buf = line_buf;
+            memmove_z(buf + edit_pos + 1, buf + edit_pos, len - edit_pos + 1);
+            buf[edit_pos++] = ch;
             refresh_line(buf, cwd, edit_pos);
         } else if (ch == 127 || ch == '\b') { // 退格
             handle_backspace(buf, cwd);
@@ -189,8 +512,226 @@ int getcmd(char* buf, int nbuf) {
             esc_state = 1;
         }
     }
-    disable_raw_mode(); // 恢复终端设置
-    return 0;
+    return buf; // 保持原始模式, 直到真正启动前台子进程 (见 fork / spawncmd)
+}
+
+// 按 bash 的格式输出一项耗时, 如 "real	0m0.005s"
+static void print_duration(const char* label, unsigned long ns) {
+    unsigned long ms = ns / 1000000;
+    cprintf<"%s\t%lum%lu.%03lus\n">(label, ms / 60000, ms / 1000 % 60, ms % 1000);
+}
+
+static inline unsigned long timeval_ns(const struct timeval& tv) { return tv.tv_sec * 1000000000UL + tv.tv_usec * 1000UL; }
+
+// 打印并清零本行各阶段的耗时 (微秒)
+static void report_phases() {
+    unsigned long us[PH_COUNT];
+    for (int i = 0; i < PH_COUNT; ++i) {
+        us[i] = phase_ns[i] / 1000;
+        phase_ns[i] = 0;
+    }
+    cprintf<"[timing] read %luus  parse %luus  spawn %luus  wait %luus\n">(us[PH_READ], us[PH_PARSE], us[PH_SPAWN],
+                                                                           us[PH_WAIT]);
+}
+
+// 执行一行命令, 返回退出状态 (同时记为 $?), 语法错误为 2.
+// 以 time 开头时整行 (包括管道和 ; 连接的命令) 结束后输出实际时间, 以及已回收子进程的用户态/内核态时间
+static int run_line(char* buf) {
+    char* s = skip_space(buf, buf + strlen(buf));
+    bool timed = strncmp(s, "time", 4) == 0 && (s[4] == '\0' || s[4] == ' ' || s[4] == '\t');
+    struct rusage ru0;
+    unsigned long t0 = 0;
+    if (timed) {
+        buf = s + 4;
+        sys_getrusage(RUSAGE_CHILDREN, &ru0);
+        t0 = now_ns();
+    }
+    // 解析和执行都在 shell 进程中进行, 用到的临时内存执行完后整体回收
+    char* mark = freem;
+    unsigned long t = phase_begin();
+    struct cmd* cmd = parsecmd(buf);
+    phase_end(PH_PARSE, t);
+    last_status = cmd ? runcmd(cmd) : 2;
+    freem = mark;
+    if (timed) {
+        unsigned long real = now_ns() - t0;
+        struct rusage ru1;
+        sys_getrusage(RUSAGE_CHILDREN, &ru1);
+        print_duration("\nreal", real);
+        print_duration("user", timeval_ns(ru1.ru_utime) - timeval_ns(ru0.ru_utime));
+        print_duration("sys", timeval_ns(ru1.ru_stime) - timeval_ns(ru0.ru_stime));
+    }
+    if (timing_enabled)
+        report_phases();
+    return last_status;
+}
+
+// 非交互模式 ---------------------------------------------------
+// 脚本整体在内存里, 按行就地切分 ('\n' 改成 '\0') 后直接交给 parsecmd, 不碰 termios, 不画提示符.
+#define SCRIPT_CHUNK (64 * 1024) // stdin 不是终端时每次 read 的块大小
+
+// 执行 [p, nl) 这一行, *nl 会被改成 '\0'
+static void run_one(char* p, char* nl, int* status) {
+    *nl = '\0';
+    char* s = skip_space(p, nl);
+    if (s < nl && *s != '#') { // 跳过空行和注释 (包括 #! 行)
+        job_reap();
+        job_report();
+        *status = run_line(p);
+    }
+}
+
+// 执行 [p, end) 中所有完整的行, 返回最后一个不完整行的起点 (没有则为 end)
+static char* run_lines(char* p, char* end, int* status) {
+    while (p < end) {
+        char* nl = memchr(p, '\n', end - p);
+        if (!nl)
+            break;
+        run_one(p, nl, status);
+        p = nl + 1;
+    }
+    return p;
+}
+
+// 执行最后一行 (没有换行结尾); line 必须以 '\0' 结尾
+static void run_last(char* line, int* status) {
+    char* s = skip_space(line, line + strlen(line));
+    if (*s && *s != '#')
+        *status = run_line(line);
+}
+
+// mysh FILE: 私有可写映射, 按行切分不会改动文件本身
+static int run_file(const char* file) {
+    int fd = sys_open(file, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || sys_fstat(fd, &st) < 0) {
+        print("mysh: cannot open ", file, "\n", nullptr);
+        return 127;
+    }
+    int status = 0;
+    if (st.st_size > 0) {
+        void* map = sys_mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mmap_failed(map)) {
+            print("mysh: cannot map ", file, "\n", nullptr);
+            sys_close(fd);
+            return 127;
+        }
+        char* end = static_cast<char*>(map) + st.st_size;
+        char* rest = run_lines(static_cast<char*>(map), end, &status);
+        if (rest < end) { // 映射末尾没有空间放 '\0', 复制出来
+            line_reserve(end - rest + 1);
+            memcpy(line_buf, rest, end - rest);
+            line_buf[end - rest] = '\0';
+            run_last(line_buf, &status);
+        }
+        sys_munmap(map, st.st_size);
+    }
+    sys_close(fd);
+    return status;
+}
+
+// stdin 不是终端. 脚本中的命令也可能读 stdin, shell 不能多读 (与 POSIX sh 相同):
+//  可 lseek 的文件: 用 pread 按块读入, 执行每行之前把读位置设到该行末尾;
+//    命令读走了 stdin 的内容时, 丢掉缓冲从新的位置接着读
+//  管道: 用 tee 复制出管道中已有的数据来找换行, 再 read 取走到换行为止的部分
+//  其它 (不支持 tee): 逐字节读
+static int run_stdin_file(off_t base) {
+    int status = 0;
+    size_t have = 0; // line_buf 的 [0, have) 是文件中从 base 开始的内容
+    while (true) {
+        line_reserve(have + SCRIPT_CHUNK + 1);
+        unsigned long t = phase_begin();
+        long n = sys_pread64(STDIN_FILENO, line_buf + have, SCRIPT_CHUNK, base + have);
+        phase_end(PH_READ, t);
+        if (n == -EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        have += n;
+        char *p = line_buf, *end = line_buf + have, *nl;
+        while ((nl = memchr(p, '\n', end - p))) {
+            off_t next = base + (nl + 1 - line_buf);
+            sys_lseek(STDIN_FILENO, next, SEEK_SET);
+            run_one(p, nl, &status);
+            p = nl + 1;
+            off_t cur = sys_lseek(STDIN_FILENO, 0, SEEK_CUR);
+            if (cur != next) {
+                base = cur, p = end = line_buf;
+                break;
+            }
+        }
+        base += p - line_buf;
+        have = end - p;
+        memmove_z(line_buf, p, have);
+    }
+    line_reserve(have + 1);
+    line_buf[have] = '\0';
+    sys_lseek(STDIN_FILENO, base + have, SEEK_SET);
+    run_last(line_buf, &status);
+    return status;
+}
+
+static int run_stdin_pipe() {
+    int status = 0;
+    size_t have = 0; // 当前行已读入的部分
+    int peek[2];
+    bool use_tee = sys_pipe2(peek, O_CLOEXEC) == 0;
+    while (true) {
+        line_reserve(have + SCRIPT_CHUNK + 1);
+        char* p = line_buf + have;
+        long want = 1;
+        unsigned long t = phase_begin();
+        if (use_tee) {
+            long n = sys_tee(STDIN_FILENO, peek[1], SCRIPT_CHUNK, 0);
+            if (n == -EINTR)
+                continue;
+            if (n == 0)
+                break;
+            if (n < 0) { // stdin 不是管道
+                sys_close(peek[0]);
+                sys_close(peek[1]);
+                use_tee = false;
+                continue;
+            }
+            long got = 0, r;
+            while (got < n && (r = sys_read(peek[0], p + got, n - got)) > 0)
+                got += r;
+            char* nl = memchr(p, '\n', got);
+            want = nl ? nl - p + 1 : got > 0 ? got : 1;
+        }
+        long n = sys_read(STDIN_FILENO, p, want);
+        phase_end(PH_READ, t);
+        if (n == -EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        have += n;
+        if (line_buf[have - 1] == '\n') {
+            run_one(line_buf, line_buf + have - 1, &status);
+            have = 0;
+        }
+    }
+    if (use_tee) {
+        sys_close(peek[0]);
+        sys_close(peek[1]);
+    }
+    line_reserve(have + 1);
+    line_buf[have] = '\0';
+    run_last(line_buf, &status);
+    return status;
+}
+
+static int run_stdin() {
+    off_t pos = sys_lseek(STDIN_FILENO, 0, SEEK_CUR);
+    return pos >= 0 ? run_stdin_file(pos) : run_stdin_pipe();
+}
+
+// mysh -c STRING: 字符串在初始栈上, 可以直接就地切分
+static int run_string(char* s) {
+    int status = 0;
+    char* rest = run_lines(s, s + strlen(s), &status);
+    run_last(rest, &status);
+    return status;
 }
 
 extern "C" void c_start(long* stack_ptr) {
@@ -198,62 +739,226 @@ extern "C" void c_start(long* stack_ptr) {
     long argc = stack_ptr[0];
     char** argv = reinterpret_cast<char**>(stack_ptr + 1);
     char** envp = argv + argc + 1;
+    char** ep = envp;
+    while (*ep)
+        ++ep;
+    vdso_init(reinterpret_cast<long*>(ep + 1)); // 辅助向量紧跟在 envp 的 NULL 之后
 
-    environ = envp; // 保存全局环境变量表
+    env_init(envp); // 导入环境变量并建立 PATH 索引
     path = getenv("PATH");
-    print("Welcome to use mysh, an unfriendly self-developed shell\n$PATH=", path, "\n", nullptr);
+    jobs_init();
+    init_arg_max();
 
-    static char buf[100];
-    while (getcmd(buf, sizeof(buf)) >= 0) {
-        if (buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' ') {
-            char* cdpath = buf + 3;
-            if (*cdpath == '\0') {
-                /*static*/ char* HOME = getenv("HOME");
-                if (HOME) {
-                    cdpath = const_cast<char*>(HOME);
-                } else {
-                    print("cd: no HOME directory\n", nullptr);
-                    continue;
-                }
+    // mysh -c STRING / mysh FILE / stdin 不是终端: 非交互执行, 以最后一条命令的状态退出
+    if (argc > 1 || !is_tty(STDIN_FILENO)) {
+        jobs_verbose = false;
+        if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+            if (argc < 3) {
+                print("usage: mysh [-c string | file]\n", nullptr);
+                exit(2);
             }
-            // Chdir must be called by the parent
-            if (syscall(SYS_chdir, cdpath) < 0)
-                print("cannot cd ", cdpath, "\n", nullptr);
-            continue;
+            exit(run_string(argv[2]));
         }
-        if (syscall(SYS_fork) == 0)
-            runcmd(parsecmd(buf));
-        syscall(SYS_wait4, -1, 0, 0, 0);
+        exit(argc > 1 ? run_file(argv[1]) : run_stdin());
     }
-    syscall(SYS_exit, 0);
+
+    print("Welcome to use mysh, an unfriendly self-developed shell\n$PATH=", path, "\n", nullptr);
+    history_init(getenv("HOME"));
+    char* buf;
+    while ((buf = getcmd()) != nullptr)
+        run_line(buf);
+    history_sync();
+    disable_raw_mode();
+    exit(0);
 }
 
 // 纯汇编入口
 __asm__(
     ".global _start\n"
     "_start:\n"
-    "mov %rsp, %rdi\n" // 将原始栈指针作为参数传递
-    "jmp c_start\n");
+    "xor %ebp, %ebp\n"
+    "mov %rsp, %rdi\n"  // 将原始栈指针作为参数传递
+    "and $-16, %rsp\n"  // 按 ABI 对齐栈, call 压入返回地址后 c_start 入口满足 16 字节对齐
+    "call c_start\n");
 
 // Parsing ------------------------------------------------------
-char whitespace[] = " \t\r\n\v";
-char symbols[] = "<|>&;()";
+constexpr char whitespace[] = " \t\r\n\v";
+constexpr char symbols[] = "<|>&;()";
+
+// 字符分类表: 编译期生成 256 项, 扫描时每个字节只查一次表, 不再对 whitespace/symbols 做 strchr
+enum : unsigned char {
+    CH_WORD = 0x00,   // 普通单词字符
+    CH_SPACE = 0x01,  // 空白
+    CH_SYMBOL = 0x02, // <|>&;()
+    CH_QUOTE = 0x04,  // ' "
+    CH_DOLLAR = 0x08, // $
+    CH_ESCAPE = 0x10, // 反斜杠
+    CH_END = 0x20,    // '\0'
+};
+// 这些字符会结束一个单词
+#define CH_BREAK (CH_SPACE | CH_SYMBOL | CH_END)
+
+struct char_table {
+    unsigned char cls[256];
+    constexpr char_table() : cls() {
+        for (const char* p = whitespace; *p; ++p)
+            cls[(unsigned char)*p] = CH_SPACE;
+        for (const char* p = symbols; *p; ++p)
+            cls[(unsigned char)*p] = CH_SYMBOL;
+        cls[(unsigned char)'\''] = cls[(unsigned char)'"'] = CH_QUOTE;
+        cls[(unsigned char)'$'] = CH_DOLLAR;
+        cls[(unsigned char)'\\'] = CH_ESCAPE;
+        cls[0] = CH_END;
+    }
+};
+static constexpr char_table char_classes;
+
+static inline unsigned char char_class(char c) { return char_classes.cls[(unsigned char)c]; }
 
-static inline const char* expand_var(char* s) {
-    if (*s == '$') {
-        const char* var_value = getenv(s + 1);
-        return var_value ? var_value : "";
+static inline char* skip_space(char* s, char* es) {
+    while (s < es && char_class(*s) == CH_SPACE)
+        s++;
+    return s;
+}
+
+// 单词在解析时只确定边界, 引号, 转义和变量都留在原文里; 命令即将执行时才展开 (见 expand_simple),
+// 所以 $? 和同一行中前面命令的赋值对后面的命令可见.
+// 返回原文中单词之后的位置. '...' 与 "..." 内的空白和符号不结束单词, 引号外 \x 表示字符 x 本身
+static char* scan_word(char* s, char* es) {
+    while (s < es) {
+        unsigned char c = char_class(*s);
+        if (c == CH_WORD || c == CH_DOLLAR) {
+            s++;
+            continue;
+        }
+        if (c & CH_BREAK)
+            break;
+        if (c == CH_ESCAPE) {
+            s += s + 1 < es ? 2 : 1;
+            continue;
+        }
+        char quote = *s++;
+        while (s < es && *s != quote)
+            s += quote == '"' && *s == '\\' && s + 1 < es ? 2 : 1;
+        if (s < es) // 跳过结束引号, 未闭合时读到行尾为止
+            s++;
     }
     return s;
 }
 
+// 展开结果的输出位置: 按原文长度分配, 变量的值放不下时换一块更大的, 之后的普通字符不用再检查
+struct word_out {
+    char *begin, *d, *lim; // lim 处留一个字节给结尾的 '\0'
+};
+
+// 保证能再写 n 个字节, 以及原文中 s 之后剩下的部分
+static void word_reserve(struct word_out* w, size_t n, const char* s) {
+    size_t rest = strlen(s);
+    if (w->d + n + rest <= w->lim)
+        return;
+    size_t used = w->d - w->begin;
+    size_t cap = used + n + rest + 1;
+    char* p = static_cast<char*>(zalloc(cap));
+    memcpy(p, w->begin, used);
+    w->begin = p;
+    w->d = p + used;
+    w->lim = p + cap - 1;
+}
+
+// 展开 s 处的 $NAME / ${NAME} / $?, 返回原文中引用之后的位置. 展开结果不再分词;
+// '$' 后面不是变量名时原样输出
+static const char* expand_var(const char* s, struct word_out* w) {
+    const char* p = s + 1;
+    char num[16];
+    const char* value;
+    if (*p == '?') {
+        cformat<"%d">(num, sizeof(num), last_status);
+        value = num;
+        ++p;
+    } else {
+        bool brace = *p == '{';
+        const char* name = p + brace;
+        p = name;
+        while (*p && is_name_char(*p, p == name))
+            ++p;
+        if (p == name || (brace && *p != '}')) {
+            *w->d++ = '$';
+            return s + 1;
+        }
+        value = env_get(name, p - name);
+        p += brace;
+    }
+    size_t len = value ? strlen(value) : 0;
+    word_reserve(w, len, p);
+    memcpy(w->d, value, len);
+    w->d += len;
+    return p;
+}
+
+// 展开一个单词: 去掉引号和转义, 替换变量. '...' 内原样保留; "..." 内展开变量, 只有 \" \\ \$ 是转义.
+// 单词中有引号或转义时 *quoted 为 true, 这样的单词展开为空也保留为一个空参数
+static char* expand_word(const char* s, bool* quoted) {
+    struct word_out w;
+    w.begin = w.d = static_cast<char*>(zalloc(strlen(s) + 1));
+    w.lim = w.begin + strlen(s);
+    *quoted = false;
+    while (*s) {
+        unsigned char c = char_class(*s);
+        if (c == CH_DOLLAR) {
+            s = expand_var(s, &w);
+            continue;
+        }
+        if (c == CH_ESCAPE) {
+            *quoted = true;
+            if (*++s)
+                *w.d++ = *s++;
+            continue;
+        }
+        if (c != CH_QUOTE) {
+            *w.d++ = *s++;
+            continue;
+        }
+        *quoted = true;
+        char quote = *s++;
+        while (*s && *s != quote) {
+            if (quote == '"' && *s == '$') {
+                s = expand_var(s, &w);
+                continue;
+            }
+            if (quote == '"' && *s == '\\' && (s[1] == '"' || s[1] == '\\' || s[1] == '$'))
+                s++;
+            *w.d++ = *s++;
+        }
+        if (*s)
+            s++;
+    }
+    *w.d = '\0';
+    return w.begin;
+}
+
+// 展开简单命令的参数和重定向文件名, 在命令即将执行时调用 (每条命令只展开一次).
+// 没有引号的单词展开为空时不产生参数, 如 "echo $UNSET x" 只有一个参数 x
+static void expand_simple(struct cmd* cmd, struct execcmd* ecmd) {
+    if (ecmd->expanded)
+        return;
+    ecmd->expanded = true;
+    bool quoted;
+    for (; cmd->type == REDIR; cmd = ((struct redircmd*)cmd)->cmd)
+        ((struct redircmd*)cmd)->file = expand_word(((struct redircmd*)cmd)->file, &quoted);
+    size_t n = 0;
+    for (char** a = ecmd->argv; *a; ++a) {
+        char* w = expand_word(*a, &quoted);
+        if (*w || quoted)
+            ecmd->argv[n++] = w;
+    }
+    ecmd->argv[n] = nullptr;
+}
+
 int gettoken(char** ps, char* es, char** q, char** eq) {
     char* s;
     int ret;
 
-    s = *ps;
-    while (s < es && strchr(whitespace, *s))
-        s++;
+    s = skip_space(*ps, es);
     if (q)
         *q = s;
     ret = *s;
@@ -277,27 +982,22 @@ int gettoken(char** ps, char* es, char** q, char** eq) {
         break;
     default:
         ret = 'a';
-        while (s < es && !strchr(whitespace, *s) && !strchr(symbols, *s))
-            s++;
+        s = scan_word(s, es);
         break;
     }
     if (eq)
         *eq = s;
 
-    while (s < es && strchr(whitespace, *s))
-        s++;
-    *ps = s;
+    *ps = skip_space(s, es);
     return ret;
 }
 
 int peek(char** ps, char* es, const char* toks) {
     char* s;
 
-    s = *ps;
-    while (s < es && strchr(whitespace, *s))
-        s++;
+    s = skip_space(*ps, es);
     *ps = s;
-    return *s && strchr(toks, *s);
+    return (char_class(*s) & CH_SYMBOL) && strchr(toks, *s);
 }
 
 struct cmd* parseline(char**, char*);
@@ -305,29 +1005,55 @@ struct cmd* parsepipe(char**, char*);
 struct cmd* parseexec(char**, char*);
 struct cmd* nulterminate(struct cmd*);
 
+// 解析在 shell 进程中进行, 语法错误只记录第一条, 不能像 assert 那样直接退出
+static const char* syntax_error;
+static void set_syntax_error(const char* msg) {
+    if (!syntax_error)
+        syntax_error = msg;
+}
+
 struct cmd* parsecmd(char* s) {
     char* es;
     struct cmd* cmd;
 
+    syntax_error = nullptr;
     es = s + strlen(s);
     cmd = parseline(&s, es);
     peek(&s, es, "");
-    assert(s == es);
+    if (s != es)
+        set_syntax_error("unexpected token");
+    if (syntax_error) {
+        print("syntax error: ", syntax_error, "\n", nullptr);
+        return 0;
+    }
     nulterminate(cmd);
     return cmd;
 }
 
+// 取出原文中 [begin, end) 这一段, 去掉结尾空白
+static const char* source_text(const char* begin, const char* end) {
+    while (end > begin && char_class(end[-1]) == CH_SPACE)
+        end--;
+    size_t len = end - begin;
+    char* text = static_cast<char*>(zalloc(len + 1));
+    memcpy(text, begin, len);
+    return text;
+}
+
 struct cmd* parseline(char** ps, char* es) {
     struct cmd* cmd;
+    char* begin = skip_space(*ps, es);
 
     cmd = parsepipe(ps, es);
     while (peek(ps, es, "&")) {
+        cmd = backcmd(cmd, source_text(begin, *ps));
         gettoken(ps, es, 0, 0);
-        cmd = backcmd(cmd);
     }
     if (peek(ps, es, ";")) {
         gettoken(ps, es, 0, 0);
         cmd = listcmd(cmd, parseline(ps, es));
+    } else if (cmd->type == BACK && *ps < es && !peek(ps, es, ")")) { // "a & b"
+        cmd = listcmd(cmd, parseline(ps, es));
     }
     return cmd;
 }
@@ -349,7 +1075,10 @@ struct cmd* parseredirs(struct cmd* cmd, char** ps, char* es) {
 
     while (peek(ps, es, "<>")) {
         tok = gettoken(ps, es, 0, 0);
-        assert(gettoken(ps, es, &q, &eq) == 'a');
+        if (gettoken(ps, es, &q, &eq) != 'a') {
+            set_syntax_error("missing file for redirection");
+            break;
+        }
         switch (tok) {
         case '<':
             cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -368,10 +1097,12 @@ struct cmd* parseredirs(struct cmd* cmd, char** ps, char* es) {
 struct cmd* parseblock(char** ps, char* es) {
     struct cmd* cmd;
 
-    assert(peek(ps, es, "("));
-    gettoken(ps, es, 0, 0);
+    gettoken(ps, es, 0, 0); // "("
     cmd = parseline(ps, es);
-    assert(peek(ps, es, ")"));
+    if (!peek(ps, es, ")")) {
+        set_syntax_error("missing )");
+        return cmd;
+    }
     gettoken(ps, es, 0, 0);
     cmd = parseredirs(cmd, ps, es);
     return cmd;
@@ -379,7 +1110,9 @@ struct cmd* parseblock(char** ps, char* es) {
 
 struct cmd* parseexec(char** ps, char* es) {
     char *q, *eq;
-    int tok, argc;
+    int tok;
+    size_t argc, cap;
+    char** words;
     struct execcmd* cmd;
     struct cmd* ret;
 
@@ -389,19 +1122,35 @@ struct cmd* parseexec(char** ps, char* es) {
     ret = execcmd();
     cmd = (struct execcmd*)ret;
 
+    // 参数个数事先未知: 先收集到按倍数扩容的临时数组, 解析完再分配恰好大小的 argv
     argc = 0;
+    cap = 16;
+    words = static_cast<char**>(zalloc(2 * cap * sizeof(char*)));
     ret = parseredirs(ret, ps, es);
     while (!peek(ps, es, "|)&;")) {
         if ((tok = gettoken(ps, es, &q, &eq)) == 0)
             break;
-        assert(tok == 'a');
-        cmd->argv[argc] = q;
-        cmd->eargv[argc] = eq;
-        assert(++argc < MAXARGS);
+        if (tok != 'a') {
+            set_syntax_error("unexpected token");
+            break;
+        }
+        if (argc == cap) {
+            char** w = static_cast<char**>(zalloc(4 * cap * sizeof(char*)));
+            memcpy(w, words, 2 * cap * sizeof(char*));
+            words = w;
+            cap *= 2;
+        }
+        words[2 * argc] = q;
+        words[2 * argc + 1] = eq;
+        argc++;
         ret = parseredirs(ret, ps, es);
     }
-    cmd->argv[argc] = 0;
-    cmd->eargv[argc] = 0;
+    cmd->argv = static_cast<char**>(zalloc((argc + 1) * sizeof(char*)));
+    cmd->eargv = static_cast<char**>(zalloc((argc + 1) * sizeof(char*)));
+    for (size_t i = 0; i < argc; ++i) {
+        cmd->argv[i] = words[2 * i];
+        cmd->eargv[i] = words[2 * i + 1];
+    }
     return ret;
 }
 
@@ -1,8 +1,6 @@
 #ifndef __MYSH_H__
 #define __MYSH_H__
 
-#define MAXARGS 10
-
 #include "memory.h"
 
 // Parsed command representation
@@ -14,7 +12,8 @@ struct cmd {
 
 struct execcmd {
     int type;
-    char *argv[MAXARGS], *eargv[MAXARGS];
+    char **argv, **eargv; // 解析完后按实际参数个数分配, 以 0 结尾
+    bool expanded;        // argv 和重定向文件名已展开 (见 expand_simple)
 };
 
 struct redircmd {
@@ -36,6 +35,7 @@ struct listcmd {
 struct backcmd {
     int type;
     struct cmd* cmd;
+    const char* text; // 命令原文, 用于作业报告
 };
 
 struct cmd* parsecmd(char*);
@@ -88,12 +88,13 @@ struct cmd* listcmd(struct cmd* left, struct cmd* right) {
     return (struct cmd*)cmd;
 }
 
-struct cmd* backcmd(struct cmd* subcmd) {
+struct cmd* backcmd(struct cmd* subcmd, const char* text) {
     struct backcmd* cmd;
 
     cmd = static_cast<struct backcmd*>(zalloc(sizeof(*cmd)));
     cmd->type = BACK;
     cmd->cmd = subcmd;
+    cmd->text = text;
     return (struct cmd*)cmd;
 }
 
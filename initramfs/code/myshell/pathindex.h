@@ -0,0 +1,215 @@
+#ifndef __PATHINDEX_H__
+#define __PATHINDEX_H__
+
+#include "mylib.h"
+
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// $PATH 索引: 启动时 (以及 PATH 改变时) 把 PATH 拆成目录表, 用 getdents64 读出每个目录的文件名,
+// 按 PATH 顺序建一张开放寻址哈希表. 命中时查找命令不需要任何系统调用.
+// 只收录当前用户可执行的普通文件 (按 mode 与 euid, 组判断), 不可执行的同名文件不会遮住后面目录中的命令.
+// 未命中或 execve 失败时才重新 stat 各目录, 只重扫 mtime 变化了的目录.
+// 目录名, 文件名表和哈希表各自放在独立映射的块中, 重扫时原地复用, 只在放不下时换成更大的块,
+// 所以 PATH 目录反复变化也不会让内存持续增长.
+#define PATH_MAX_DIRS 64
+
+struct linux_dirent64 {
+    unsigned long d_ino;
+    long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct path_dir {
+    char* name; // 以 '\0' 结尾的目录名
+    size_t len, name_cap;
+    long mtime_sec, mtime_nsec;
+    char* names;   // 目录中的文件名, 依次以 '\0' 分隔
+    size_t nnames; // 文件名个数
+    size_t names_cap;
+};
+
+struct path_slot {
+    const char* name; // nullptr 表示空槽
+    unsigned hash;
+    int dir;
+};
+
+static struct path_dir path_dirs[PATH_MAX_DIRS];
+static int path_ndirs;
+static struct path_slot* path_table;
+static size_t path_mask; // 容量 - 1, 容量为 2 的幂
+static size_t path_table_bytes;
+
+static inline unsigned hash_str(const char* s) { // FNV-1a
+    unsigned h = 2166136261u;
+    for (; *s; ++s)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+// 保证 *block 至少有 need 字节, 保留前 keep 字节; 换块时释放旧块
+static void path_reserve(void** block, size_t* cap, size_t need, size_t keep) {
+    if (need <= *cap)
+        return;
+    size_t ncap = *cap ? *cap : 4096;
+    while (ncap < need)
+        ncap *= 2;
+    void* p = sys_mmap(nullptr, ncap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(!mmap_failed(p));
+    if (*block) {
+        memcpy(p, *block, keep);
+        sys_munmap(*block, *cap);
+    }
+    *block = p;
+    *cap = ncap;
+}
+
+// 当前用户能否执行这个文件: 与内核的权限判断相同, 依次看属主, 所属组 (含附加组), 其他人
+static bool path_can_exec(const struct stat* st) {
+    static bool init;
+    static uid_t euid;
+    static gid_t egid, groups[64];
+    static int ngroups;
+    if (!init) {
+        euid = sys_geteuid();
+        egid = sys_getegid();
+        ngroups = sys_getgroups(sizeof(groups) / sizeof(groups[0]), groups);
+        if (ngroups < 0)
+            ngroups = 0;
+        init = true;
+    }
+    if (!S_ISREG(st->st_mode))
+        return false;
+    if (euid == 0)
+        return st->st_mode & (S_IXUSR | S_IXGRP | S_IXOTH);
+    if (st->st_uid == euid)
+        return st->st_mode & S_IXUSR;
+    bool in_group = st->st_gid == egid;
+    for (int i = 0; i < ngroups && !in_group; ++i)
+        in_group = groups[i] == st->st_gid;
+    return st->st_mode & (in_group ? S_IXGRP : S_IXOTH);
+}
+
+// 读取目录的 mtime 与可执行文件名表; 目录不存在时清空
+static void path_scan_dir(struct path_dir* d) {
+    static char dents[16384];
+    struct stat st;
+    d->nnames = 0;
+    d->mtime_sec = d->mtime_nsec = -1;
+    int fd = sys_open(d->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (sys_fstat(fd, &st) == 0) {
+        d->mtime_sec = st.st_mtim.tv_sec;
+        d->mtime_nsec = st.st_mtim.tv_nsec;
+    }
+    size_t used = 0;
+    long n;
+    while ((n = sys_getdents64(fd, dents, sizeof(dents))) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64* de = (struct linux_dirent64*)(dents + off);
+            off += de->d_reclen;
+            if (de->d_name[0] == '.')
+                continue; // . .. 和隐藏文件不作为命令
+            if (de->d_type != DT_REG && de->d_type != DT_LNK && de->d_type != DT_UNKNOWN)
+                continue; // 子目录, 设备, 管道等不可能是命令
+            if (sys_fstatat(fd, de->d_name, &st, 0) != 0 || !path_can_exec(&st))
+                continue; // 跟随符号链接
+            size_t len = strlen(de->d_name) + 1;
+            path_reserve((void**)&d->names, &d->names_cap, used + len, used);
+            memcpy(d->names + used, de->d_name, len);
+            used += len;
+            d->nnames++;
+        }
+    }
+    sys_close(fd);
+}
+
+// 按 PATH 顺序把所有目录的文件名插入哈希表, 同名时前面的目录优先
+static void path_rebuild_table() {
+    size_t total = 0;
+    for (int i = 0; i < path_ndirs; ++i)
+        total += path_dirs[i].nnames;
+    size_t cap = 16;
+    while (cap < total * 2)
+        cap *= 2;
+    path_reserve((void**)&path_table, &path_table_bytes, cap * sizeof(struct path_slot), 0);
+    memset(path_table, 0, cap * sizeof(struct path_slot));
+    path_mask = cap - 1;
+    for (int i = 0; i < path_ndirs; ++i) {
+        const char* name = path_dirs[i].names;
+        for (size_t k = 0; k < path_dirs[i].nnames; ++k, name += strlen(name) + 1) {
+            unsigned h = hash_str(name);
+            size_t j = h & path_mask;
+            for (; path_table[j].name; j = (j + 1) & path_mask) {
+                if (path_table[j].hash == h && strcmp(path_table[j].name, name) == 0)
+                    break;
+            }
+            if (!path_table[j].name)
+                path_table[j] = {name, h, i};
+        }
+    }
+}
+
+// 拆分 PATH 并建立索引; PATH 改变时重新调用
+void path_index_init(const char* path) {
+    path_ndirs = 0;
+    while (path && path_ndirs < PATH_MAX_DIRS) {
+        const char* colon = strchr(path, ':');
+        size_t len = colon ? (size_t)(colon - path) : strlen(path);
+        struct path_dir* d = &path_dirs[path_ndirs++];
+        d->len = len ? len : 1; // 空项表示当前目录
+        path_reserve((void**)&d->name, &d->name_cap, d->len + 1, 0);
+        memcpy(d->name, len ? path : ".", d->len);
+        d->name[d->len] = '\0';
+        path_scan_dir(d);
+        path = colon ? colon + 1 : nullptr;
+    }
+    path_rebuild_table();
+}
+
+// 重新 stat 各目录, 只重扫 mtime 变化的目录; 有变化时返回 true
+bool path_index_revalidate() {
+    bool changed = false;
+    for (int i = 0; i < path_ndirs; ++i) {
+        struct path_dir* d = &path_dirs[i];
+        struct stat st;
+        long sec = -1, nsec = -1;
+        if (sys_stat(d->name, &st) == 0)
+            sec = st.st_mtim.tv_sec, nsec = st.st_mtim.tv_nsec;
+        if (sec != d->mtime_sec || nsec != d->mtime_nsec) {
+            path_scan_dir(d);
+            changed = true;
+        }
+    }
+    if (changed)
+        path_rebuild_table();
+    return changed;
+}
+
+// 在索引中查找命令, 找到时把完整路径写入 buf
+static bool path_index_lookup(const char* cmd, char* buf, size_t size) {
+    if (!path_table)
+        return false;
+    unsigned h = hash_str(cmd);
+    for (size_t j = h & path_mask; path_table[j].name; j = (j + 1) & path_mask) {
+        const struct path_slot* slot = &path_table[j];
+        if (slot->hash == h && strcmp(slot->name, cmd) == 0) {
+            const struct path_dir* d = &path_dirs[slot->dir];
+            size_t clen = strlen(cmd);
+            if (d->len + 1 + clen + 1 > size)
+                return false;
+            memcpy(buf, d->name, d->len);
+            buf[d->len] = '/';
+            memcpy(buf + d->len + 1, cmd, clen + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // __PATHINDEX_H__
@@ -0,0 +1,56 @@
+#ifndef __SPAWN_H__
+#define __SPAWN_H__
+
+#include "syscall.h"
+
+#include <linux/sched.h>
+#include <signal.h>
+
+// 轻量级进程创建: clone(CLONE_VM | CLONE_VFORK), 子进程与 shell 共享地址空间, 不复制页表.
+// 子进程在独立的小栈上运行 fn(arg); 父进程在子进程 execve 或退出之前一直挂起.
+// 约定: fn 可以读父进程的任何数据, 但只能通过系统调用产生副作用, 唯一允许写的内存是 arg 指向的结构
+// (用来把失败原因交回父进程). 不能调用会修改全局状态的函数: 输出缓冲, 堆分配, 各种索引和表.
+// fn 返回时以其返回值退出. 返回子进程 pid, 失败时为 -errno.
+#define SPAWN_STACK_SIZE (64 * 1024)
+#define SPAWN_CLONE_FLAGS 0x4111 // CLONE_VM(0x100) | CLONE_VFORK(0x4000) | SIGCHLD(17)
+#define SPAWN_STR_(x) #x
+#define SPAWN_STR(x)  SPAWN_STR_(x)
+
+static_assert(SPAWN_CLONE_FLAGS == (CLONE_VM | CLONE_VFORK | SIGCHLD), "SPAWN_CLONE_FLAGS must match clone(2)");
+
+static char spawn_stack[SPAWN_STACK_SIZE] __attribute__((aligned(16)));
+
+extern "C" long clone_vfork_raw(int (*fn)(void*), void* arg, void* stack_top);
+
+__asm__(
+    ".text\n"
+    ".global clone_vfork_raw\n"
+    "clone_vfork_raw:\n"
+    "and $-16, %rdx\n"
+    "sub $16, %rdx\n"
+    "mov %rdi, 0(%rdx)\n" // 子进程栈顶放 fn 和 arg
+    "mov %rsi, 8(%rdx)\n"
+    "mov %rdx, %rsi\n"    // newsp
+    "mov $" SPAWN_STR(SPAWN_CLONE_FLAGS) ", %edi\n" // flags
+    "xor %edx, %edx\n"    // parent_tid
+    "xor %r10d, %r10d\n"  // child_tid
+    "xor %r8d, %r8d\n"    // tls
+    "mov $56, %eax\n"     // SYS_clone
+    "syscall\n"
+    "test %rax, %rax\n"
+    "jnz 1f\n"
+    "xor %ebp, %ebp\n" // 子进程: 在新栈上调用 fn(arg), 然后以返回值退出
+    "pop %rax\n"
+    "pop %rdi\n"
+    "call *%rax\n"
+    "mov %eax, %edi\n"
+    "mov $60, %eax\n" // SYS_exit
+    "syscall\n"
+    "1:\n"
+    "ret\n");
+
+static_assert(SYS_clone == 56 && SYS_exit == 60, "clone_vfork_raw hard-codes x86_64 syscall numbers");
+
+inline long clone_vfork(int (*fn)(void*), void* arg) { return clone_vfork_raw(fn, arg, spawn_stack + sizeof(spawn_stack)); }
+
+#endif // __SPAWN_H__
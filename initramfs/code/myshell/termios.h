@@ -26,13 +26,11 @@ enum {
 
 // 架构相关系统调用号及命令
 #if defined(__x86_64__)
-#define SYS_IOCTL 16
 #define TCGETS    0x5401
 #define TCSETS    0x5402
 #define TCSETSW   0x5403 // 新增TCSADRAIN命令
 #define TCSETSF   0x5404 // 新增TCSAFLUSH命令
 #elif defined(__aarch64__)
-#define SYS_IOCTL 29
 #define TCGETS    0x403c7413
 #define TCSETS    0x803c7414
 #define TCSETSW   0x803c7415 // 需确认实际值
@@ -56,9 +54,9 @@ struct termios {
 #error "Termios structure not defined for this arch"
 #endif
 
-static long sys_ioctl(int fd, unsigned long cmd, void* arg) { return syscall(SYS_IOCTL, fd, cmd, arg); }
-
-struct termios orig_termios;
+// 原始模式只在第一次进入时读取终端设置, 之后只在 shell 读命令 (原始) 与前台子进程运行 (规范) 之间切换
+struct termios orig_termios, raw_termios;
+static bool termios_saved, raw_active;
 
 // 跨平台函数
 int tcgetattr(int fd, struct termios* t) {
@@ -87,21 +85,37 @@ int tcsetattr(int fd, int opt, const struct termios* t) {
     return sys_ioctl(fd, cmd, (void*)t) == 0 ? 0 : -1;
 }
 
-void enable_raw_mode() {
-    struct termios raw;
-    tcgetattr(STDIN_FILENO, &orig_termios);
-    raw = orig_termios;
-    // 关闭规范模式、回显、信号处理
-    // raw.c_lflag &= ~(ICANON | ECHO | ISIG);
-    raw.c_lflag &= ~ICANON;
-    // 设置最小读取字节数和超时
-    raw.c_cc[VMIN] = 1;  // 至少读取1字节
-    raw.c_cc[VTIME] = 0; // 无超时
+// 不打印错误的 TCGETS 探测, 用来判断 fd 是否为终端
+bool is_tty(int fd) {
+    struct termios t;
+    return sys_ioctl(fd, TCGETS, &t) == 0;
+}
 
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+// 切换都用 TCSANOW: TCSAFLUSH 会丢掉尚未读取的输入, 命令执行期间预先键入的内容就没了
+void enable_raw_mode() {
+    if (raw_active)
+        return;
+    if (!termios_saved) {
+        if (tcgetattr(STDIN_FILENO, &orig_termios) != 0)
+            return;
+        raw_termios = orig_termios;
+        // 关闭规范模式、回显、信号处理
+        // raw_termios.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw_termios.c_lflag &= ~ICANON;
+        // 设置最小读取字节数和超时
+        raw_termios.c_cc[VMIN] = 1;  // 至少读取1字节
+        raw_termios.c_cc[VTIME] = 0; // 无超时
+        termios_saved = true;
+    }
+    raw_active = tcsetattr(STDIN_FILENO, TCSANOW, &raw_termios) == 0;
 }
 
-void disable_raw_mode() { tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios); }
+// 启动前台子进程前以及退出时调用; 已经是规范模式时不做系统调用
+void disable_raw_mode() {
+    if (raw_active)
+        tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
+    raw_active = false;
+}
 
 static_assert(offsetof(struct termios, c_lflag) == 12, "c_lflag offset mismatch");
 static_assert(offsetof(struct termios, c_cc) == 20, "c_cc array offset error");